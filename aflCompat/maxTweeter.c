@@ -8,9 +8,40 @@
  * @bug Memory-Leak in Forced Exits From ProcessData and On
  */
 
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 /* max characters in one csv line */
 #define MAX_CHAR 1024
@@ -18,6 +49,126 @@
 /* max number of lines in the csv file */
 #define MAX_LINE 20000
 
+/* number of hash partitions the count table is spilled into */
+#define SPILL_PARTITIONS 16
+
+/* most spilled runs finishSpill merges (and keeps open) at once */
+#define SPILL_FAN_IN 64
+
+/* size of one block read ahead by the --pipeline reader thread */
+#define BLOCK_SIZE (1 << 20)
+
+/* number of blocks in the --pipeline ring */
+#define BLOCK_COUNT 4
+
+/* formats openInput recognizes by their magic bytes */
+#define INPUT_PLAIN 0
+#define INPUT_GZIP 1
+#define INPUT_ZSTD 2
+
+/* most output reserved up front from a gzip member's size field (the
+ * BGZF block maximum); larger members grow their buffer as they decode */
+#define GZIP_RESERVE_MAX (1 << 16)
+
+/* most clients a --serve daemon keeps connected at once */
+#define SERVE_CLIENTS 64
+
+/* phases --perf attributes counters to, in the order they are reported */
+#define PHASE_HEADER 0
+#define PHASE_READ 1
+#define PHASE_TOKENIZE 2
+#define PHASE_INSERT 3
+#define PHASE_RANKING 4
+#define PERF_PHASES 5
+
+/* hardware events counted by --perf, plus wall-clock time in the last column */
+#define PERF_EVENTS 4
+
+/* --sample reads blocks of at most SAMPLE_BLOCK bytes, SAMPLE_ROUND at a time,
+ * and stops once the top count has held for SAMPLE_STABLE_ROUNDS rounds
+ * after at least SAMPLE_MIN_BLOCKS blocks */
+#define SAMPLE_BLOCK (1 << 16)
+#define SAMPLE_ROUND 16
+#define SAMPLE_MIN_BLOCKS 64
+#define SAMPLE_STABLE_ROUNDS 3
+
+/* --distribution keeps about DIGEST_COMPRESSION centroids and merges
+ * values in once DIGEST_BUFFER times that many are buffered */
+#define DIGEST_COMPRESSION 500
+#define DIGEST_BUFFER 5
+
+/* --all is written RANK_BUFFER bytes at a time and sorted on several
+ * threads once the table holds RANK_PARALLEL_MIN names */
+#define RANK_BUFFER (1 << 20)
+#define RANK_PARALLEL_MIN (1 << 16)
+#define RANK_MAGIC "MXTR"
+#define RANK_VERSION 1
+
+/* --quarantine only enforces its error rate once QUARANTINE_MIN_ROWS rows
+ * have been read (and again at the end of the file) */
+#define QUARANTINE_MIN_ROWS 1000
+
+/* the reports --diff prints, in order */
+#define DIFF_CURRENT 0
+#define DIFF_GAIN 1
+#define DIFF_RELATIVE 2
+#define DIFF_NEW 3
+#define DIFF_DROPPED 4
+#define DIFF_REPORTS 5
+
+/* --build-cache files start with CACHE_MAGIC and keep every section
+ * CACHE_ALIGN-byte aligned so mapped columns can be read in place */
+#define CACHE_MAGIC "MXTC"
+#define CACHE_VERSION 1
+#define CACHE_ALIGN 8
+#define CACHE_INTEGER 1
+#define CACHE_STRING 2
+
+/* --shard-cache entries start with SHARD_MAGIC; --shard-hash reads the
+ * shards SHARD_HASH_BUFFER bytes at a time */
+#define SHARD_MAGIC "MXTS"
+#define SHARD_VERSION 2
+#define SHARD_HASH_BUFFER (1 << 20)
+
+/* --publish segments start with PUBLISH_MAGIC; the top names are
+ * published again every PUBLISH_BATCH rows, and a reader gives up on a
+ * sequence left odd for PUBLISH_STALL_NANOS */
+#define PUBLISH_MAGIC "MXTL"
+#define PUBLISH_VERSION 1
+#define PUBLISH_BATCH 4096
+#define PUBLISH_STALL_NANOS 1000000000ULL
+
+/* --metrics counter blocks are METRICS_LINE-byte aligned; phase latencies
+ * go into METRICS_BUCKETS power-of-two buckets, the first ending at
+ * 1 << METRICS_FIRST_BUCKET nanoseconds, plus one for anything slower */
+#define METRICS_LINE 64
+#define METRICS_BUCKETS 16
+#define METRICS_FIRST_BUCKET 6
+#define METRICS_REASONS 8
+#define METRICS_REQUEST 4096
+
+/* --index records the offset of every INDEX_STRIDE-th row */
+#define INDEX_STRIDE 1024
+#define INDEX_MAGIC "MXTI"
+#define INDEX_VERSION 2
+
+/* what --utf8 does with a row holding malformed UTF-8 */
+#define UTF8_OFF 0
+#define UTF8_REJECT 1
+#define UTF8_FLAG 2
+
+/* error bits of the UTF-8 validator's lookup tables, one per kind of bad byte pair */
+#define UTF8_TOO_SHORT 0x01
+#define UTF8_TOO_LONG 0x02
+#define UTF8_OVERLONG_3 0x04
+#define UTF8_TOO_LARGE 0x08
+#define UTF8_SURROGATE 0x10
+#define UTF8_OVERLONG_2 0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4 0x40
+#define UTF8_TWO_CONTS 0x80
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
 /**
  * Tweeter defines the data struct which
  * stores the username and the number
@@ -46,43 +197,989 @@ typedef struct node
 /**
  * Link defines an object which contains the address
  * to the HEAD and TAIL of the doubly-linked list
+ * 
+ * bytes estimates the heap used by the nodes and names so
+ * the list can spill itself once it outgrows --max-memory.
  */
 typedef struct doublelink
 {
 	struct node *head;
 	struct node *last;
+	unsigned long bytes;
+	struct spill *spill;	/* NULL unless --max-memory is set */
+	struct namedictionary *dict;	/* replaces the nodes when --compact is set */
+	struct sharedtable *shared;	/* replaces the nodes when --concurrent is set */
+	int older;		/* with shared, count into the --diff old input's column */
 } Link;
 
+/**
+ * Options defines the optional behaviour requested on the
+ * command line. Every optional stage is off by default so a
+ * plain `./maxTweeter.exe file` call behaves exactly as before.
+ */
+typedef struct options
+{
+	char *fileName;		/* first positional file */
+	char **files;		/* every positional file */
+	int fileCount;
+	char *dedupColumn;	/* header name of the id column used for dedup */
+	int dedupIndex;		/* resolved index of dedupColumn, -1 if unused */
+	char *onlyNames;	/* file of names to count, NULL counts everyone */
+	struct watchlist *watchlist;	/* onlyNames loaded once by a --serve daemon, NULL to load it per call */
+	long windowSeconds;	/* length of a time window, 0 for all-time counts */
+	long slideSeconds;	/* step between windows, equal to windowSeconds for tumbling */
+	char *timeColumn;	/* header name of the timestamp column used for windows */
+	int timeIndex;		/* resolved index of timeColumn, -1 if unused */
+	int topCount;		/* number of tweeters printed per leaderboard */
+	char *emitPartial;	/* file the full count table is written to, NULL if unused */
+	unsigned long maxMemory;	/* bytes the count table may use before spilling, 0 for no limit */
+	int compact;		/* count in a NameDictionary instead of the linked list */
+	int pipeline;		/* read ahead on a separate thread with a BlockReader */
+	int threads;		/* worker threads for parallel stages, 0 for one per CPU */
+	int merge;		/* merge the positional partial files instead of reading a CSV */
+	char *serve;		/* UNIX socket path queries are answered on, NULL if unused */
+	int concurrent;		/* read every file at once into one SharedTable */
+	long liveSeconds;	/* print a --concurrent snapshot this often, 0 for none */
+	struct perfcounters *perf;	/* --perf counters, NULL if unused */
+	int fold;		/* group names by their case-folded, composed form */
+	int utf8Mode;		/* UTF8_OFF, UTF8_REJECT or UTF8_FLAG */
+	int sample;		/* estimate the top names from randomly chosen blocks */
+	int index;		/* build or reuse the row-offset index sidecar */
+	int diff;		/* --diff: compare the rankings of the two files */
+	struct tdigest *digest;	/* --distribution sketch of the final counts, NULL if unused */
+	char *rankPath;		/* --all output file, NULL if unused */
+	int rankBinary;		/* write --all in the binary format instead of CSV */
+	struct quarantine *quarantine;	/* --quarantine skips and records bad rows, NULL to stop at the first */
+	long firstRow;		/* first data row (1-based) read with --rows, 0 for all */
+	long lastRow;		/* last data row read with --rows, 0 for the end of the file */
+	long rowLimit;		/* rows processData may read, 0 for no limit */
+	long lineBase;		/* file line of processData's first row, 0 if unknown */
+	char *buildCache;	/* --build-cache output file, NULL if unused */
+	char *headerLine;	/* copy of the CSV header kept for --build-cache */
+	int cache;		/* the positional file is a --build-cache file to query */
+	char *shardCache;	/* directory of per-shard count tables, NULL if unused */
+	int shardHash;		/* also key --shard-cache entries by a hash of the contents */
+	char *publish;		/* shared-memory segment the top names are published to, NULL if unused */
+	struct publisher *publisher;	/* writer of the --publish segment, NULL if unused */
+	char *readPublished;	/* print the leaderboard published to this segment instead of reading a CSV */
+	char *metricsPath;	/* UNIX socket the --metrics endpoint listens on, NULL if unused */
+	struct metrics *metrics;	/* the --metrics endpoint, NULL if unused */
+	struct metricscounters *metricsCounters;	/* this ingest thread's --metrics counters, NULL if unused */
+	int summary;		/* print the run summary to stderr */
+} Options;
+
+/**
+ * Summary defines the counters reported in the run summary
+ * once the whole file has been processed.
+ */
+typedef struct summary
+{
+	long rowsRead;
+	long rowsCounted;
+	long duplicates;
+	long notWatched;
+	unsigned long watchlistSize;
+	long windowsPrinted;
+	long lateRows;
+	long partialsMerged;
+	unsigned long partialNames;
+	int spilledRuns;
+	long malformedRows;
+	long sampledBlocks;
+	long sampleSlots;
+	long estimatedRows;
+	int indexReused;
+	long indexedRows;
+	long rankedNames;
+	long quarantined;
+	long shardsReused;
+	long shardsParsed;
+	long bytesRead;
+} Summary;
+
+/**
+ * IdSet defines an open-addressing set of 64-bit ids.
+ * 
+ * Ids are stored inline in a power-of-two array and probed
+ * linearly, so each id costs one 8 byte slot (plus load factor
+ * headroom) and no per-id allocation. Zero marks an empty slot,
+ * so a zero id is tracked on the side with hasZero.
+ */
+typedef struct idset
+{
+	uint64_t *slots;
+	unsigned long capacity;
+	unsigned long size;
+	int hasZero;
+} IdSet;
+
+/**
+ * Watchlist defines the read-only set of names loaded by --only-names.
+ * 
+ * Every name lives in one buffer (the list file read in one go). Lookups
+ * first check a Bloom filter, which is small enough to stay in cache and
+ * rejects most names that aren't on the list with no string compare.
+ * Names that pass are verified exactly in an open-addressing table that
+ * keeps each name's hash next to its pointer.
+ */
+typedef struct watchlist
+{
+	char *buffer;
+	uint64_t *bloom;
+	unsigned long bloomMask;	/* number of bloom bits - 1 */
+	char **names;
+	uint64_t *hashes;
+	unsigned long capacity;
+	unsigned long size;
+} Watchlist;
+
+/**
+ * WindowKey defines one tweeter tracked by the windowed leaderboard.
+ * 
+ * counts is a ring of one counter per slide, so it always holds the
+ * newest window's worth of buckets for this tweeter; lastBucket is the
+ * newest bucket written and total the sum of the whole ring.
+ */
+typedef struct windowkey
+{
+	char *name;
+	uint64_t hash;
+	long lastBucket;
+	long total;
+	int *counts;
+} WindowKey;
+
+/**
+ * WindowTable defines the state of the windowed leaderboard.
+ * 
+ * Time is cut into buckets of one slide each and a window spans
+ * bucketsPerWindow buckets. Windows end on multiples of the slide and
+ * are printed as soon as a row from a later bucket arrives, so the input
+ * has to be (mostly) in time order. Keys live in a dense array indexed
+ * by an open-addressing table of positions.
+ */
+typedef struct windowtable
+{
+	WindowKey *keys;
+	long *slots;			/* index into keys, -1 for empty */
+	unsigned long capacity;		/* number of slots */
+	unsigned long size;		/* number of keys */
+	unsigned long allocated;	/* room in keys */
+	long bucketSeconds;
+	int bucketsPerWindow;
+	long newestBucket;
+	long nextEmit;			/* bucket at which the next window closes */
+	int started;
+	int topCount;
+} WindowTable;
+
+/* first bytes of every partial result file */
+#define PARTIAL_MAGIC "MXTP"
+
+/* bumped whenever the partial result layout changes */
+#define PARTIAL_VERSION 1
+
+/**
+ * PartialReader defines one input of the partial result merge.
+ * 
+ * A partial file is PARTIAL_MAGIC, a 32-bit version, the 64-bit number of
+ * names and the 64-bit number of rows behind them, followed by one record
+ * per name in strcmp order. Each record is front-coded against the
+ * previous name: varint shared prefix length, varint suffix length, the
+ * suffix bytes and a varint count. name always holds the current record.
+ * A --shard-cache entry keeps its records in first-seen order instead and
+ * is read with unordered set.
+ */
+typedef struct partialreader
+{
+	FILE *file;
+	uint64_t remaining;
+	char name[MAX_CHAR];
+	int length;
+	uint64_t count;
+	int unordered;	/* skips the strcmp order check */
+} PartialReader;
+
+/**
+ * Spill defines the temporary files the count table is spilled to.
+ * 
+ * Every spill sorts the table by name and appends one run to each
+ * partition file, holding the names which hash to that partition in the
+ * partial result format. offsets[run * SPILL_PARTITIONS + partition] is
+ * where each run starts, so the runs of one partition can be read back
+ * side by side and merged.
+ */
+typedef struct spill
+{
+	unsigned long budget;
+	char *paths[SPILL_PARTITIONS];
+	FILE *files[SPILL_PARTITIONS];
+	long *offsets;
+	int runs;
+} Spill;
+
+/**
+ * NameDictionary defines the compact count table used by --compact.
+ * 
+ * Every distinct name is stored once, back to back in a single arena,
+ * and gets a dense integer id in first-seen order. offsets[id] locates
+ * the name in the arena and counts[id] holds its count, so ranking is a
+ * scan over one contiguous int array. Names are found through an
+ * open-addressing table of id + 1 (0 for empty) with the upper hash bits
+ * kept alongside, so most probes never touch the arena.
+ * 
+ * A name costs its bytes plus about 25 bytes of arrays, against a Node,
+ * a separate name allocation and their malloc headers in the list.
+ */
+typedef struct namedictionary
+{
+	char *arena;
+	unsigned long arenaSize;
+	unsigned long arenaCapacity;
+	uint32_t *offsets;
+	int *counts;
+	unsigned long size;
+	unsigned long allocated;
+	uint32_t *slots;
+	uint32_t *fingerprints;
+	unsigned long capacity;
+} NameDictionary;
+
+/**
+ * Block defines one buffer of the --pipeline ring. data always ends
+ * on a line boundary (except at end of file or for a line longer than
+ * the block), so the parser never has to stitch lines across blocks.
+ */
+typedef struct block
+{
+	char *data;
+	size_t length;
+} Block;
+
+/**
+ * BlockReader defines the read-ahead stage used by --pipeline.
+ * 
+ * A dedicated thread read()s the file into BLOCK_COUNT page-aligned
+ * blocks of BLOCK_SIZE bytes and hands complete-line blocks to the
+ * parser through a ring guarded by lock, so the next blocks are being
+ * read while the current one is parsed. The thread reads its own dup of
+ * the file descriptor, so closing the FILE on an error can't pull it out
+ * from under the thread.
+ */
+typedef struct blockreader
+{
+	int fd;
+	Block blocks[BLOCK_COUNT];
+	int readIndex;		/* next block handed to the parser */
+	int writeIndex;		/* next block filled by the thread */
+	int filled;		/* blocks waiting for the parser */
+	int done;		/* the thread reached end of file */
+	int failed;		/* the thread hit a read error */
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	pthread_t thread;
+	Block *current;		/* block being parsed, NULL before the first */
+	size_t position;	/* parser offset into current */
+} BlockReader;
+
+/**
+ * Decoder defines the background stage which turns a compressed input
+ * into the plain CSV stream the rest of the program reads.
+ * 
+ * The decoded bytes are written in order into a pipe whose read end
+ * replaces the input file, so every other stage works on compressed
+ * files unchanged. Inputs which are not regular files (and so can't be
+ * mmap()ed or rewound) are decoded as one stream; prefix holds the magic
+ * bytes already read from them.
+ */
+typedef struct decoder
+{
+	int in;
+	int out;
+	int format;
+	unsigned char prefix[4];
+	int prefixLength;
+	unsigned char *map;	/* whole input for regular files, else NULL */
+	size_t size;
+	int threads;
+} Decoder;
+
+/**
+ * Chunk defines one independently decodable piece of a compressed file:
+ * a zstd frame, or a gzip member whose size is recorded in its header
+ * (BGZF style, as written by bgzip).
+ */
+typedef struct chunk
+{
+	const unsigned char *data;
+	size_t size;
+	unsigned char *output;
+	size_t length;
+	size_t capacity;
+	int done;
+} Chunk;
+
+/**
+ * DecodeJob defines the shared state of a parallel decode. Workers take
+ * chunks in order but finish in any order; the decoder thread writes
+ * them to the pipe strictly in order. Workers stay at most window chunks
+ * ahead of the writer, which bounds the decoded bytes held in memory.
+ */
+typedef struct decodejob
+{
+	Decoder *decoder;
+	Chunk *chunks;
+	int count;
+	int taken;
+	int written;
+	int window;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} DecodeJob;
+
+/**
+ * Source defines one CSV kept open by a --serve daemon. offset is where
+ * the next unread row starts; rows appended after it are ingested on
+ * the daemon's next wake-up, once their line is complete.
+ */
+typedef struct source
+{
+	char *path;
+	FILE *file;
+	long offset;
+	int namePos;
+	int quoted;
+	int comma;
+	int oneCol;
+	int skipping;		/* dropping the rest of an overlong appended row */
+} Source;
+
+/**
+ * Server defines the state of a --serve daemon.
+ * 
+ * Counts live in a NameDictionary so single names are found by hash.
+ * ranking holds every id ordered as the top 10 would print them (count,
+ * then first seen) and ranks the inverse, so top K and rank queries
+ * don't scan the table. Both are rebuilt lazily after new rows arrive.
+ * Invalid appended rows are skipped and counted in rejects, so one bad
+ * line can't take the daemon down.
+ */
+typedef struct server
+{
+	Source *sources;
+	int sourceCount;
+	Link *info;
+	Options *opts;
+	Summary *summary;
+	uint32_t *ranking;
+	uint32_t *ranks;
+	int stale;
+	int running;
+	struct quarantine *rejects;	/* counts the skipped rows, writes no file */
+} Server;
+
+/**
+ * SharedName defines one name of a SharedTable. Entries are never moved
+ * or freed while producers run, so a pointer to one stays valid and its
+ * count can be bumped with a single atomic add.
+ */
+typedef struct sharedname
+{
+	struct sharedname *_Atomic next;
+	atomic_int count;
+	atomic_int before;	/* --diff only: rows of the old input, count holds the new one's */
+	uint64_t hash;
+	char name[];
+} SharedName;
+
+/**
+ * SharedTable defines the count table --concurrent producers share.
+ * 
+ * Each bucket is a lock-free singly linked chain. Known names cost a
+ * hash, a short chain walk and an atomic increment. A new name is pushed
+ * onto the front of its chain with a compare-and-swap; a producer that
+ * loses the race rechecks only the entries pushed in front of it, so two
+ * producers never add the same name twice. The bucket count is fixed up
+ * front from the input size, which spares the table a concurrent resize.
+ */
+typedef struct sharedtable
+{
+	SharedName *_Atomic *buckets;
+	unsigned long mask;
+	atomic_ulong size;
+} SharedTable;
+
+/**
+ * Producer defines one --concurrent ingest thread: its own file, header
+ * layout, options copy (resolved column indexes differ per file), list
+ * head and counters, all counting into the shared table through info.
+ */
+typedef struct producer
+{
+	Source source;
+	Link *info;
+	Options opts;
+	Summary summary;
+	struct concurrentrun *run;
+} Producer;
+
+/**
+ * ConcurrentRun defines what the --concurrent main thread waits on: the
+ * number of producers still reading, signalled as each one finishes.
+ */
+typedef struct concurrentrun
+{
+	int running;
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+} ConcurrentRun;
+
+/**
+ * RowIndex defines the --index sidecar of a CSV.
+ * 
+ * offsets[k] is the byte offset of data row k * stride (rows counted
+ * from 0 after the header) and lines[k] the file line it starts on.
+ * Rows end at every newline, as processData reads them line by line
+ * (a quote is just a byte of an unquoted field, and a quoted field
+ * can't span lines). The sidecar is only trusted while the CSV's size
+ * and mtime match the ones it was built for.
+ */
+typedef struct rowindex
+{
+	long size;
+	long mtimeSeconds;
+	long mtimeNanos;
+	long stride;
+	long rows;
+	long entries;
+	long *offsets;
+	long *lines;
+} RowIndex;
+
+/**
+ * PerfCounters defines the --perf measurement of the main thread.
+ * 
+ * The hardware events are opened as one perf_event group, so a phase
+ * boundary costs a single read() of every counter. slots[event] is the
+ * event's position in that read, -1 if the CPU or kernel wouldn't count
+ * it. Only user space is counted, so the reads themselves add little.
+ * When no event can be opened leader is -1, reason says why and only
+ * wall-clock time (the last column) is collected.
+ */
+typedef struct perfcounters
+{
+	int leader;
+	int slots[PERF_EVENTS];
+	int opened;
+	int phase;
+	char *reason;
+	uint64_t last[PERF_EVENTS + 1];
+	uint64_t totals[PERF_PHASES][PERF_EVENTS + 1];
+} PerfCounters;
+
+/**
+ * Centroid defines a cluster of values in a TDigest.
+ */
+typedef struct centroid
+{
+	double mean;
+	double weight;
+} Centroid;
+
+/**
+ * TDigest defines the --distribution sketch of tweets per tweeter.
+ * 
+ * It is a merging t-digest: values are appended to a buffer after the
+ * merged centroids and, once the array is full, everything is sorted by
+ * mean and merged again under the k1 scale function, which keeps the
+ * centroids near either tail small. Quantiles are then interpolated
+ * between centroid means with at most about compression centroids in
+ * memory, however many tweeters there are. min, max and the power of
+ * two histogram (bucket b holds counts in [2^b, 2^(b+1))) are exact.
+ */
+typedef struct tdigest
+{
+	double compression;
+	Centroid *centroids;
+	int merged;
+	int buffered;
+	int capacity;
+	double weight;
+	double sum;
+	double min;
+	double max;
+	unsigned long histogram[64];
+} TDigest;
+
+/**
+ * RadixJob defines one thread's share of a rankTweeters step.
+ * 
+ * A radix pass moves [begin, end) of from into to, using offsets as the
+ * digit histogram and then as the next free slot of every digit. The
+ * tie-breaking step sorts the runs of equal counts starting in
+ * [begin, end) of from, which holds size tweeters.
+ */
+typedef struct radixjob
+{
+	Tweeter *from;
+	Tweeter *to;
+	long begin;
+	long end;
+	long size;
+	int shift;
+	long *offsets;
+} RadixJob;
+
+/**
+ * RankWriter defines the buffered output of --all.
+ * 
+ * The binary format is RANK_MAGIC, a 32-bit version and the 64-bit number
+ * of names, then one record per name in rank order: its 32-bit count,
+ * 16-bit name length and the name bytes, all in host byte order like the
+ * partial file header.
+ */
+typedef struct rankwriter
+{
+	int fd;
+	char *buffer;
+	size_t used;
+} RankWriter;
+
+/**
+ * Quarantine defines where --quarantine writes the rows it skips.
+ * 
+ * Every skipped row becomes one line of the file: its line number, a tab,
+ * the reason, a tab and the row as read. line holds a copy of the current
+ * row, taken before tokenizing overwrites its commas.
+ */
+typedef struct quarantine
+{
+	char *path;
+	FILE *file;
+	double maxRate;
+	long rows;
+	char line[MAX_LINE + 1];
+} Quarantine;
+
+/**
+ * DiffEntry defines one name of a --diff with its old and new counts.
+ */
+typedef struct diffentry
+{
+	char *name;
+	int before;
+	int after;
+} DiffEntry;
+
+/**
+ * PublishedName defines one slot of a --publish leaderboard.
+ */
+typedef struct publishedname
+{
+	int64_t count;
+	char name[MAX_CHAR];
+} PublishedName;
+
+/**
+ * Published defines the layout of a --publish shared-memory segment.
+ * 
+ * sequence is a seqlock: the one writer makes it odd before changing
+ * anything and even again afterwards. A reader copies what it needs
+ * between two loads of sequence and retries unless both saw the same
+ * even value, so readers never block the writer or each other.
+ */
+typedef struct published
+{
+	char magic[4];
+	uint32_t version;
+	_Atomic uint64_t sequence;
+	uint32_t capacity;	/* slots in top */
+	uint32_t size;		/* slots in use, best first */
+	int64_t rowsRead;
+	int64_t rowsCounted;
+	int64_t offset;		/* input bytes read when the snapshot was taken */
+	int64_t updatedNanos;	/* CLOCK_REALTIME of the snapshot */
+	int32_t finished;	/* 1 once the run is over */
+	int32_t reserved;
+	PublishedName top[];
+} Published;
+
+/**
+ * Publisher defines the writer side of a --publish segment.
+ */
+typedef struct publisher
+{
+	Published *segment;
+	size_t bytes;
+	Tweeter *top;		/* ranking of the next snapshot */
+	long nextRow;		/* rowsRead at which the next snapshot is taken */
+} Publisher;
+
+/**
+ * MetricsCounters defines the --metrics counters of one ingest thread.
+ * 
+ * Only the owning thread writes them, with a plain load and store rather
+ * than a locked add, and every block starts a cache line of its own, so
+ * the hot loop never touches a line another thread writes. The endpoint
+ * thread adds the blocks up with relaxed loads: a scrape may see one
+ * counter a row ahead of another, but never a torn value.
+ */
+typedef struct metricscounters
+{
+	_Alignas(METRICS_LINE) atomic_ulong rows;
+	atomic_ulong bytes;
+	atomic_ulong names;		/* names this thread added to the count table */
+	atomic_ulong tableBytes;	/* heap those names take up */
+	atomic_ulong rejected[METRICS_REASONS];	/* indexed by metricsReason */
+	atomic_ulong latency[PERF_PHASES][METRICS_BUCKETS + 1];
+	atomic_ulong latencyNanos[PERF_PHASES];
+	int phase;		/* owner only: the phase being timed */
+	uint64_t phaseStart;	/* owner only: CLOCK_MONOTONIC nanoseconds it began at */
+} MetricsCounters;
+
+/**
+ * Metrics defines the --metrics endpoint: its socket, the thread that
+ * answers it and one counter block per ingest thread.
+ */
+typedef struct metrics
+{
+	char *path;
+	int listener;
+	pthread_t thread;
+	atomic_int running;
+	MetricsCounters *blocks;
+	int blockCount;
+	uint64_t startNanos;	/* CLOCK_MONOTONIC when the endpoint was opened */
+} Metrics;
+
+/**
+ * ShardKey defines the start of a --shard-cache entry.
+ * 
+ * Everything up to rowsRead identifies the shard file and the options it
+ * was counted with; an entry is only reused while all of it matches. The
+ * shard's count table follows as a partial result, in first-seen order.
+ */
+typedef struct shardkey
+{
+	char magic[4];
+	uint32_t version;
+	int64_t size;
+	int64_t mtimeSeconds;
+	int64_t mtimeNanos;
+	uint64_t header;	/* hash of the header line */
+	uint64_t content;	/* hash of the whole file, 0 without --shard-hash */
+	uint32_t options;	/* --fold, --utf8 and --shard-hash */
+	uint32_t reserved;
+	int64_t rowsRead;
+	int64_t malformedRows;
+} ShardKey;
+
+/**
+ * CacheHeader defines the start of a --build-cache file.
+ * 
+ * The header is followed by one CacheColumn per CSV column and then by
+ * the sections the columns point at. Everything is in host byte order,
+ * so a cache is meant to be read on the kind of machine that built it.
+ */
+typedef struct cacheheader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t rows;
+	uint32_t columns;
+	int32_t nameColumn;
+} CacheHeader;
+
+/**
+ * CacheColumn defines one column of a --build-cache file.
+ * 
+ * Row r of a column is the width-byte entry r at data. In an integer
+ * column the entry is the value minus base; in a string column it is a
+ * code, and offsets[code] is where the code's NUL-terminated value
+ * starts in the strings section. title is the offset of the column's
+ * header field.
+ */
+typedef struct cachecolumn
+{
+	uint32_t type;		/* CACHE_INTEGER or CACHE_STRING */
+	uint32_t width;		/* 1, 2, 4 or 8 */
+	uint64_t title;
+	uint64_t data;
+	int64_t base;
+	uint64_t values;	/* distinct values, for string columns */
+	uint64_t offsets;
+	uint64_t strings;
+	uint64_t stringBytes;
+} CacheColumn;
+
+/**
+ * CacheBuilder defines one column while --build-cache reads the CSV:
+ * the distinct values in a dictionary and the code of every row.
+ */
+typedef struct cachebuilder
+{
+	Link values;
+	uint32_t *codes;
+} CacheBuilder;
+
+void addToWindow(WindowTable *windows, char *name, long bucket);
 char *allocateName(char *nameToCopy, Link *info);
-void argumentCheck(int numArg);
+void answerQuery(Server *server, char *query, FILE *reply);
+void buildCache(FILE *fileName, int namePos, int quoted, int comma, int oneCol, Options *opts, Summary *summary);
+RowIndex *buildRowIndex(int fd, struct stat *status);
+int cacheColumnValid(CacheColumn *column, const char *base, uint64_t size, uint64_t rows);
+uint64_t cacheEntry(CacheColumn *column, const char *base, uint64_t row);
+int cacheInteger(char *text, int64_t *value);
+int cacheWidth(uint64_t max);
+uint64_t cacheWrite(FILE *out, const void *data, uint64_t length);
 void checkFile(FILE *fileName);
-void checkQuotes(char *name, FILE *filename, Link *info);
+char *checkQuotes(char *name);
+void chunkReserve(Chunk *chunk, size_t extra);
+void closeMetrics(Metrics *metrics);
+void closePublisher(Publisher *publisher);
+void closeQuarantine(Quarantine *quarantine, FILE *fileName, Summary *summary);
+Tweeter *collectTweeters(Link *info, long *size);
 int commaCounter(char *line);
+int compareCentroids(const void *left, const void *right);
+int compareCountsDescending(const void *left, const void *right);
+int compareKeys(const void *left, const void *right);
+int compareTweeterNames(const void *left, const void *right);
+uint32_t composeMark(uint32_t base, uint32_t mark);
+void compressDigest(TDigest *digest);
+long countCacheCodes(CacheColumn *column, const char *base, uint64_t rows, long *groups, int *counts, uint64_t *last);
+void countShards(Options *opts, Summary *summary);
+BlockReader *createBlockReader(FILE *file);
+NameDictionary *createDictionary(void);
+TDigest *createDigest(double compression);
+IdSet *createIdSet(void);
+Metrics *createMetrics(char *path, int blockCount);
 Node *createNode(int initial, Link *info);
-char *extractName(char *str, int namePos, int quoted, FILE *filename, Link *info);
+Publisher *createPublisher(char *name, int capacity);
+Quarantine *createQuarantine(void);
+SharedTable *createSharedTable(unsigned long expected);
+Spill *createSpill(unsigned long budget);
+FILE *createSpillFile(char **path);
+WindowTable *createWindowTable(Options *opts);
+void decodeChunk(int format, Chunk *chunk);
+void *decodeInput(void *arg);
+void decodeParallel(Decoder *decoder, Chunk *chunks, int count);
+void decodeStream(Decoder *decoder);
+void *decodeWorker(void *arg);
+int detectFormat(unsigned char *magic, int length);
+void dictionaryAdd(Link *info, char *name);
+long dictionaryFind(NameDictionary *dict, char *name);
+void dictionaryMerge(Link *info, char *name, int count);
+double diffScore(DiffEntry *entry, int kind);
+int diffTop(DiffEntry *entries, long size, int kind, DiffEntry **top, int limit);
+void digestAdd(TDigest *digest, double value);
+double digestQuantile(TDigest *digest, double q);
+void digestTable(TDigest *digest, Link *info);
+int duplicateRow(char *line, Options *opts, IdSet *ids);
+void emitWindow(WindowTable *windows, long endBucket, Summary *summary);
+void evictWindowKeys(WindowTable *windows, long oldestLiveBucket);
+void exportRanking(Link *info, Options *opts, Summary *summary);
+char *extractName(char *str, int namePos, int quoted, char **error);
+char *fieldAt(char *line, int index, int *length);
 int findUser(char *name, Link *info);
+void finishSpill(Link *info, Options *opts, Summary *summary);
+void finishWindows(WindowTable *windows, Summary *summary);
+uint32_t foldCodePoint(uint32_t code);
+void foldName(char *name);
 void forceExit(char *exitMsg);
+void freeBlockReader(BlockReader *reader);
+void freeDictionary(NameDictionary *dict);
+void freeIdSet(IdSet *ids);
 void freeLinkedMemory(Node *head, Link *info);
-int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol);
+void freeRowIndex(RowIndex *index);
+void freeSharedTable(SharedTable *table);
+void freeWatchlist(Watchlist *watch);
+void freeWindowTable(WindowTable *windows);
+int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol, Options *opts);
+void growDictionarySlots(NameDictionary *dict);
+void growIdSet(IdSet *ids);
+uint64_t hashFile(char *path);
+uint64_t hashName(char *name);
+int idSetInsert(IdSet *ids, uint64_t id);
+void ingestConcurrently(Options *opts, Summary *summary);
+long ingestSource(Server *server, Source *source, int whole);
+void initOptions(Options *opts);
 void insertAtLast(char *name, Link *info);
 void insertToList(char *name, Link *info);
+int isAscii(const char *text, size_t length);
+Watchlist *loadWatchlist(char *path, int fold);
+void lowerAscii(char *text, size_t length);
+int matchesColumn(char *token, char *column);
+void mergePartials(Options *opts, Summary *summary);
+void mergeReaders(PartialReader *readers, int count, FILE *out, Tweeter *top, int *topSize, int limit,
+		unsigned long *names, TDigest *digest);
+void metricsAdd(atomic_ulong *counter, unsigned long amount);
+void metricsPhase(MetricsCounters *metrics, int phase);
+int metricsReason(char *exitMsg);
+void metricsTable(MetricsCounters *metrics, Link *info, unsigned long before);
+uint64_t monotonicNanos(void);
+int nextPartialRecord(PartialReader *reader);
+FILE *openInput(char *path, Options *opts);
+void openPartial(PartialReader *reader, char *path, long offset, Summary *summary);
+RowIndex *openRowIndex(char *path, Summary *summary);
+void openSource(Source *source, char *path, Options *opts);
+void openSpillFiles(Spill *spill);
+void parseArguments(int argc, char *argv[], Options *opts);
+int parseId(char *field, int length, uint64_t *id);
+long parseNumberArg(char *arg, char *errorMsg);
+unsigned long parseSizeArg(char *arg, char *errorMsg);
+int parseTimestamp(char *field, int length, long *seconds);
+void partialHeader(FILE *out, uint64_t names, uint64_t rows);
+void partialRecord(FILE *out, char *name, char *previous, uint64_t count);
+void perfPhase(PerfCounters *perf, int phase);
+void perfRead(PerfCounters *perf, uint64_t *values);
+void perfReport(PerfCounters *perf, Summary *summary);
+void perfStart(PerfCounters *perf);
+void printDictionary(NameDictionary *dict, int count);
+void printDistribution(TDigest *digest);
 void printList(Node *head, int count);
-void processData(FILE *fileName, int namePos, Link *info, int quoted, int comma, int oneCol);
+void printShared(SharedTable *table, int limit);
+void printSummary(Summary *summary, Options *opts);
+void printTop(Tweeter *top, int size);
+void processData(FILE *fileName, int namePos, Link *info, int quoted, int comma, int oneCol,
+		Options *opts, Summary *summary);
+void *produceRows(void *arg);
+void publishTop(Publisher *publisher, Link *info, Summary *summary, int finished);
+void queryCache(Options *opts, Summary *summary);
+void *radixHistogram(void *arg);
+uint32_t radixKey(int count);
+void *radixScatter(void *arg);
+void rankFlush(RankWriter *writer);
+void rankNames(Server *server);
+long rankOf(int *counts, long size, int count);
+void rankTweeters(Tweeter *tweeters, long size, int threads);
+void rankWrite(RankWriter *writer, const void *data, size_t length);
+char *readBlockLine(BlockReader *reader, char *buff, int size);
+void *readBlocks(void *arg);
+void readPublished(Options *opts, Summary *summary);
+RowIndex *readRowIndex(char *path);
+int readVarint(FILE *in, uint64_t *value);
+void rebuildWindowSlots(WindowTable *windows);
+int reduceRuns(char **paths, long *offsets, int count, char **scratch);
 void removeChar(char *str, int index);
-void stripQuotes(char *name, FILE *filename, Link *info);
+void reportDiff(SharedTable *table, int limit);
+void resetList(Link *info);
+void rowError(FILE *fileName, char *exitMsg, Options *opts, long row);
+void runRadixJobs(RadixJob *jobs, pthread_t *workers, int threads, void *(*step)(void *));
+long sampleBlock(FILE *file, long start, long blockBytes, long dataStart, long fileSize, char *buffer, int namePos,
+		int quoted, int comma, int oneCol, Link *info, Watchlist *watch, Options *opts, Summary *summary);
+void sampleFile(FILE *file, int namePos, int quoted, int comma, int oneCol, Options *opts, Summary *summary);
+void seekToRow(FILE *file, RowIndex *index, Options *opts);
+int sendReply(int fd, char *text, size_t length);
+void serve(Options *opts, Summary *summary);
+void *serveMetrics(void *arg);
+void shardKey(char *path, ShardKey *key, Options *opts);
+int sharedAdd(SharedTable *table, char *name, int older);
+void siftDownReaders(PartialReader **heap, int size, int index);
+void skipLine(FILE *fileName, BlockReader *reader);
+void *sortTies(void *arg);
+void spillList(Link *info);
+int splitChunks(Decoder *decoder, Chunk **chunks);
+char *stripQuotes(char *name);
 void swap(Node *left, Node *right, Link *info);
+int threadCount(Options *opts);
 void trimNewLine(char *name);
+void updateTop(Tweeter *top, int *size, int limit, char *name, int count);
+int validUtf8(const char *text, size_t length);
+int validUtf8Scalar(const char *text, size_t length);
+int validUtf8Ssse3(const char *text, size_t length);
+int watchlistAdd(Watchlist *watch, char *name);
+int watchlistContains(Watchlist *watch, char *name);
+void writeAll(int fd, const void *data, size_t length);
+void writeCache(char *path, CacheBuilder *columns, int count, int namePos, char *header, uint64_t rows);
+void writeMetrics(Metrics *metrics, FILE *out);
+void writePartial(char *path, ShardKey *key, Link *info, Summary *summary);
+int writeRowIndex(char *path, RowIndex *index);
+void writeVarint(FILE *out, uint64_t value);
 
 int main(int argc, char *argv[])
 {
-	argumentCheck(argc);
-	FILE *fileName = fopen(argv[1], "r");
-	if (fileName == NULL) forceExit("\nError: No file\n");
-	checkFile(fileName);
+	Options opts;
+	Summary summary = { 0 };
+	initOptions(&opts);
+	parseArguments(argc, argv, &opts);
+	if (opts.readPublished != NULL) {
+		readPublished(&opts, &summary);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	} else if (opts.merge) {
+		mergePartials(&opts, &summary);
+		if (opts.digest != NULL) printDistribution(opts.digest);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	} else if (opts.concurrent) {
+		ingestConcurrently(&opts, &summary);
+		if (opts.digest != NULL) printDistribution(opts.digest);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	}
+	if (opts.metricsPath != NULL && !opts.concurrent) {
+		opts.metrics = createMetrics(opts.metricsPath, 1);
+		opts.metricsCounters = opts.metrics -> blocks;
+	}
+	if (opts.serve != NULL) {
+		serve(&opts, &summary);
+		if (opts.metrics != NULL) closeMetrics(opts.metrics);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	} else if (opts.shardCache != NULL) {
+		countShards(&opts, &summary);
+		if (opts.digest != NULL) printDistribution(opts.digest);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	} else if (opts.cache) {
+		queryCache(&opts, &summary);
+		if (opts.summary) printSummary(&summary, &opts);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	}
+	if (opts.perf != NULL) perfStart(opts.perf);
+	RowIndex *index = opts.index ? openRowIndex(opts.fileName, &summary) : NULL;
+	FILE *fileName = openInput(opts.fileName, &opts);
+	// unbuffered, the header is read without reading ahead into the data
+	// the --pipeline thread reads straight from the file descriptor
+	if (opts.pipeline) setvbuf(fileName, NULL, _IONBF, 0);
+	// --sample only reads part of the file, so it has no size limit
+	if (!opts.sample) checkFile(fileName);
 	int quoted = -1;
 	int comma = 0;
 	int oneCol = -1;
-	int namePos = getNameIndex(fileName, &quoted, &comma, &oneCol);
+	int namePos = getNameIndex(fileName, &quoted, &comma, &oneCol, &opts);
+	if (opts.dedupColumn != NULL && opts.dedupIndex == -1) {
+		fclose(fileName);
+		forceExit("\nError: Dedup column not found\n");
+	} else if (opts.windowSeconds > 0 && opts.timeIndex == -1) {
+		fclose(fileName);
+		forceExit("\nError: Time column not found\n");
+	}
+	if (index != NULL) {
+		seekToRow(fileName, index, &opts);
+		freeRowIndex(index);
+	}
+	if (opts.sample) {
+		sampleFile(fileName, namePos, quoted, comma, oneCol, &opts, &summary);
+		printSummary(&summary, &opts);
+		fclose(fileName);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	} else if (opts.buildCache != NULL) {
+		buildCache(fileName, namePos, quoted, comma, oneCol, &opts, &summary);
+		if (opts.summary) printSummary(&summary, &opts);
+		fclose(fileName);
+		free(opts.headerLine);
+		free(opts.files);
+		return EXIT_SUCCESS;
+	}
 	Link *info = malloc(sizeof(Link));
 	if (info == NULL) {
 		fclose(fileName);
@@ -91,10 +1188,39 @@ int main(int argc, char *argv[])
 	Node *first = createNode(1, info);
 	info -> head = first;
 	info -> last = first;
-	processData(fileName, namePos, info, quoted, comma, oneCol);
-	printList(info -> head, 10);
+	info -> bytes = 0;
+	info -> spill = NULL;
+	info -> dict = NULL;
+	info -> shared = NULL;
+	if (opts.maxMemory > 0) info -> spill = createSpill(opts.maxMemory);
+	if (opts.compact) info -> dict = createDictionary();
+	if (opts.publish != NULL) opts.publisher = createPublisher(opts.publish, opts.topCount);
+	processData(fileName, namePos, info, quoted, comma, oneCol, &opts, &summary);
+	if (opts.publisher != NULL) closePublisher(opts.publisher);
+	if (opts.metrics != NULL) closeMetrics(opts.metrics);
+	perfPhase(opts.perf, PHASE_RANKING);
+	if (info -> spill != NULL && info -> spill -> runs > 0) {
+		// part of the table is on disk -- totals come from merging the runs
+		finishSpill(info, &opts, &summary);
+	} else {
+		// windowed runs print their leaderboards while reading
+		if (info -> dict != NULL) {
+			printDictionary(info -> dict, opts.topCount);
+		} else if (opts.windowSeconds == 0) {
+			printList(info -> head, opts.topCount);
+		}
+		if (opts.emitPartial != NULL) writePartial(opts.emitPartial, NULL, info, &summary);
+		if (opts.digest != NULL) digestTable(opts.digest, info);
+		if (opts.rankPath != NULL) exportRanking(info, &opts, &summary);
+		free(info -> spill);
+	}
+	if (opts.digest != NULL) printDistribution(opts.digest);
+	if (opts.perf != NULL) perfReport(opts.perf, &summary);
+	if (opts.summary) printSummary(&summary, &opts);
 	fclose(fileName);
+	if (info -> dict != NULL) freeDictionary(info -> dict);
 	freeLinkedMemory(info -> head, info);
+	free(opts.files);
 	return EXIT_SUCCESS;
 }
 
@@ -111,31 +1237,361 @@ void forceExit(char *exitMsg)
 }
 
 /**
- * @brief Checks the number of arguments given
+ * @brief Sets every option to its default (off) value
+ * 
+ * @param opts Options struct to be initialized
+ * @return void
+ */
+void initOptions(Options *opts)
+{
+	opts -> fileName = NULL;
+	opts -> files = NULL;
+	opts -> fileCount = 0;
+	opts -> dedupColumn = NULL;
+	opts -> dedupIndex = -1;
+	opts -> onlyNames = NULL;
+	opts -> watchlist = NULL;
+	opts -> windowSeconds = 0;
+	opts -> slideSeconds = 0;
+	opts -> timeColumn = "tweet_created";
+	opts -> timeIndex = -1;
+	opts -> topCount = 10;
+	opts -> emitPartial = NULL;
+	opts -> maxMemory = 0;
+	opts -> compact = 0;
+	opts -> pipeline = 0;
+	opts -> threads = 0;
+	opts -> merge = 0;
+	opts -> serve = NULL;
+	opts -> concurrent = 0;
+	opts -> liveSeconds = 0;
+	opts -> perf = NULL;
+	opts -> fold = 0;
+	opts -> utf8Mode = UTF8_OFF;
+	opts -> sample = 0;
+	opts -> index = 0;
+	opts -> diff = 0;
+	opts -> digest = NULL;
+	opts -> rankPath = NULL;
+	opts -> rankBinary = 0;
+	opts -> quarantine = NULL;
+	opts -> firstRow = 0;
+	opts -> lastRow = 0;
+	opts -> rowLimit = 0;
+	opts -> lineBase = 0;
+	opts -> buildCache = NULL;
+	opts -> headerLine = NULL;
+	opts -> cache = 0;
+	opts -> shardCache = NULL;
+	opts -> shardHash = 0;
+	opts -> publish = NULL;
+	opts -> publisher = NULL;
+	opts -> readPublished = NULL;
+	opts -> metricsPath = NULL;
+	opts -> metrics = NULL;
+	opts -> metricsCounters = NULL;
+	opts -> summary = 0;
+}
+
+/**
+ * @brief Parses the program arguments into opts
+ * 
+ * parseArguments will exit the program if there's an invalid program call (missing csv path or
+ * unknown option), or will print a message notifying only the first file will be used if multiple
+ * files are given.
+ * 
+ * Supported options:
  * 
- * argumentCheck will exit the program if there's an invalid program call (missing csv path), or
- * will print a message notifying only the first file will be used if multiple args are given.
+ *   --dedup column      Skip rows whose id in `column` was already seen
+ *   --only-names file   Only count names listed (one per line) in `file`
+ *   --window seconds    Print a leaderboard per time window instead of all-time counts
+ *   --slide seconds     Step between windows (default: the window, i.e. tumbling)
+ *   --time-column col   Timestamp column used by --window (default: tweet_created)
+ *   --top count         Number of tweeters per leaderboard (default: 10)
+ *   --emit-partial out  Write the full count table to `out` as a partial result
+ *   --max-memory size   Spill the count table to disk beyond `size` bytes (K, M, G suffixes)
+ *   --compact           Count in a compact name dictionary instead of the linked list
+ *   --pipeline          Read the file ahead in large blocks on a separate thread
+ *   --threads count     Worker threads for parallel stages (default: one per CPU)
+ *   --merge             Treat every file as a partial result and merge them
+ *   --serve socket      Keep every file loaded and answer queries on a UNIX socket
+ *   --concurrent        Read every file at once on its own thread into one shared table
+ *   --live seconds      With --concurrent, print the current top 10 this often
+ *   --perf              Report hardware counters per row for each phase to stderr
+ *   --fold              Count names case-insensitively and by their composed Unicode form
+ *   --utf8 mode         Check rows are valid UTF-8: `reject` exits, `flag` counts them
+ *   --sample            Estimate the top 10 from random blocks of the file, with 95% intervals
+ *   --index             Build (or reuse) the row-offset index sidecar `file.mxi`
+ *   --rows first-last   Only read data rows first to last (1-based, `first-` for the rest)
+ *   --distribution      Print percentiles and a histogram of tweets per tweeter to stderr
+ *   --all out           Write every name and count, ranked, to `out`
+ *   --all-format fmt    Format of --all: `csv` (default) or `binary`
+ *   --quarantine out    Skip invalid rows, writing each with its line and reason to `out`
+ *   --max-error-rate pct  With --quarantine, give up once more than pct% of rows are invalid (default: 1)
+ *   --diff              Compare two files (old new): rank moves, gainers, new names and dropouts
+ *   --build-cache out   Convert the CSV into the columnar cache `out`
+ *   --cache             Read the file as a --build-cache cache
+ *   --shard-cache dir   Count every shard file, reusing count tables cached in `dir`
+ *   --shard-hash        With --shard-cache, also key shards by a hash of their contents
+ *   --publish name      Publish the top names to the shared-memory segment `name`
+ *   --read-published name  Print the leaderboard last published to `name`
+ *   --metrics path      Serve Prometheus metrics over HTTP on the UNIX socket `path`
+ *   --summary           Print row counters to stderr after the top 10
  * 
- * @param numArg The number of args given
+ * @param argc The number of args given
+ * @param argv The args given
+ * @param opts Options struct to be filled in
  * @return void
  */
-void argumentCheck(int numArg)
+void parseArguments(int argc, char *argv[], Options *opts)
 {
-	if (numArg < 2) {
-		forceExit("\nInvalid Program Call -- Usage: ./maxTweeter.exe locationOfCSV\n");
-	} else if (numArg > 2) {
+	double maxErrorRate = -1;
+	opts -> files = malloc(argc * sizeof(char *));
+	if (opts -> files == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--dedup") == 0) {
+			if (i + 1 >= argc) forceExit("\nInvalid Program Call -- --dedup needs a column name\n");
+			opts -> dedupColumn = argv[++i];
+			opts -> summary = 1;
+		} else if (strcmp(argv[i], "--only-names") == 0) {
+			if (i + 1 >= argc) forceExit("\nInvalid Program Call -- --only-names needs a file\n");
+			opts -> onlyNames = argv[++i];
+			opts -> summary = 1;
+		} else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+			opts -> windowSeconds = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --window\n");
+		} else if (strcmp(argv[i], "--slide") == 0 && i + 1 < argc) {
+			opts -> slideSeconds = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --slide\n");
+		} else if (strcmp(argv[i], "--time-column") == 0 && i + 1 < argc) {
+			opts -> timeColumn = argv[++i];
+		} else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+			opts -> topCount = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --top\n");
+		} else if (strcmp(argv[i], "--emit-partial") == 0 && i + 1 < argc) {
+			opts -> emitPartial = argv[++i];
+		} else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+			opts -> maxMemory = parseSizeArg(argv[++i], "\nInvalid Program Call -- Bad --max-memory\n");
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			opts -> pipeline = 1;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			opts -> threads = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --threads\n");
+		} else if (strcmp(argv[i], "--compact") == 0) {
+			opts -> compact = 1;
+		} else if (strcmp(argv[i], "--merge") == 0) {
+			opts -> merge = 1;
+		} else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			opts -> serve = argv[++i];
+			opts -> compact = 1;
+		} else if (strcmp(argv[i], "--concurrent") == 0) {
+			opts -> concurrent = 1;
+		} else if (strcmp(argv[i], "--live") == 0 && i + 1 < argc) {
+			opts -> liveSeconds = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --live\n");
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			if (opts -> perf == NULL) opts -> perf = malloc(sizeof(PerfCounters));
+			if (opts -> perf == NULL) forceExit("\nError: Couldn't allocate memory\n");
+		} else if (strcmp(argv[i], "--fold") == 0) {
+			opts -> fold = 1;
+		} else if (strcmp(argv[i], "--utf8") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "reject") == 0) {
+				opts -> utf8Mode = UTF8_REJECT;
+			} else if (strcmp(argv[i], "flag") == 0) {
+				opts -> utf8Mode = UTF8_FLAG;
+				opts -> summary = 1;
+			} else {
+				forceExit("\nInvalid Program Call -- --utf8 must be reject or flag\n");
+			}
+		} else if (strcmp(argv[i], "--sample") == 0) {
+			opts -> sample = 1;
+			opts -> summary = 1;
+		} else if (strcmp(argv[i], "--all") == 0 && i + 1 < argc) {
+			opts -> rankPath = argv[++i];
+		} else if (strcmp(argv[i], "--all-format") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "csv") == 0) {
+				opts -> rankBinary = 0;
+			} else if (strcmp(argv[i], "binary") == 0) {
+				opts -> rankBinary = 1;
+			} else {
+				forceExit("\nInvalid Program Call -- --all-format must be csv or binary\n");
+			}
+		} else if (strcmp(argv[i], "--quarantine") == 0 && i + 1 < argc) {
+			if (opts -> quarantine == NULL) opts -> quarantine = createQuarantine();
+			opts -> quarantine -> path = argv[++i];
+		} else if (strcmp(argv[i], "--max-error-rate") == 0 && i + 1 < argc) {
+			char *end = NULL;
+			maxErrorRate = strtod(argv[++i], &end);
+			if (end == argv[i] || *end != '\0' || !(maxErrorRate >= 0 && maxErrorRate <= 100)) {
+				forceExit("\nInvalid Program Call -- --max-error-rate must be a percentage\n");
+			}
+		} else if (strcmp(argv[i], "--build-cache") == 0 && i + 1 < argc) {
+			opts -> buildCache = argv[++i];
+		} else if (strcmp(argv[i], "--cache") == 0) {
+			opts -> cache = 1;
+		} else if (strcmp(argv[i], "--shard-cache") == 0 && i + 1 < argc) {
+			opts -> shardCache = argv[++i];
+		} else if (strcmp(argv[i], "--shard-hash") == 0) {
+			opts -> shardHash = 1;
+		} else if (strcmp(argv[i], "--publish") == 0 && i + 1 < argc) {
+			opts -> publish = argv[++i];
+		} else if (strcmp(argv[i], "--read-published") == 0 && i + 1 < argc) {
+			opts -> readPublished = argv[++i];
+		} else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+			opts -> metricsPath = argv[++i];
+		} else if (strcmp(argv[i], "--diff") == 0) {
+			opts -> diff = 1;
+			opts -> concurrent = 1;
+		} else if (strcmp(argv[i], "--distribution") == 0) {
+			if (opts -> digest == NULL) opts -> digest = createDigest(DIGEST_COMPRESSION);
+		} else if (strcmp(argv[i], "--index") == 0) {
+			opts -> index = 1;
+		} else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+			char *end = NULL;
+			opts -> firstRow = strtol(argv[++i], &end, 10);
+			if (end == argv[i] || *end != '-' || opts -> firstRow <= 0) {
+				forceExit("\nInvalid Program Call -- --rows must be first-last\n");
+			}
+			if (end[1] != '\0') opts -> lastRow = parseNumberArg(end + 1, "\nInvalid Program Call -- --rows must be first-last\n");
+			if (opts -> lastRow > 0 && opts -> lastRow < opts -> firstRow) {
+				forceExit("\nInvalid Program Call -- --rows must be first-last\n");
+			}
+			opts -> index = 1;
+		} else if (strcmp(argv[i], "--summary") == 0) {
+			opts -> summary = 1;
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			forceExit("\nInvalid Program Call -- Unknown option\n");
+		} else {
+			opts -> files[opts -> fileCount++] = argv[i];
+		}
+	}
+	if (opts -> fileCount > 0) opts -> fileName = opts -> files[0];
+	if (opts -> slideSeconds == 0) opts -> slideSeconds = opts -> windowSeconds;
+	if (opts -> slideSeconds > 0 && opts -> windowSeconds == 0) {
+		forceExit("\nInvalid Program Call -- --slide needs --window\n");
+	} else if (opts -> windowSeconds > 0 && (opts -> windowSeconds % opts -> slideSeconds != 0
+			|| opts -> windowSeconds / opts -> slideSeconds > 1024)) {
+		forceExit("\nInvalid Program Call -- --window must be a multiple (at most 1024x) of --slide\n");
+	} else if (opts -> emitPartial != NULL && opts -> windowSeconds > 0) {
+		forceExit("\nInvalid Program Call -- --emit-partial can't be used with --window\n");
+	} else if (opts -> serve != NULL && (opts -> windowSeconds > 0 || opts -> dedupColumn != NULL
+			|| opts -> emitPartial != NULL || opts -> maxMemory > 0 || opts -> merge)) {
+		forceExit("\nInvalid Program Call -- --serve can't be used with --window, --dedup, --emit-partial, --max-memory or --merge\n");
+	} else if (opts -> concurrent && (opts -> windowSeconds > 0 || opts -> maxMemory > 0 || opts -> compact
+			|| opts -> serve != NULL || opts -> merge)) {
+		forceExit("\nInvalid Program Call -- --concurrent can't be used with --window, --max-memory, --compact, --serve or --merge\n");
+	} else if (opts -> perf != NULL && (opts -> merge || opts -> serve != NULL || opts -> concurrent)) {
+		forceExit("\nInvalid Program Call -- --perf can't be used with --merge, --serve or --concurrent\n");
+	} else if (opts -> sample && (opts -> windowSeconds > 0 || opts -> dedupColumn != NULL || opts -> emitPartial != NULL
+			|| opts -> maxMemory > 0 || opts -> merge || opts -> serve != NULL || opts -> concurrent || opts -> perf != NULL)) {
+		forceExit("\nInvalid Program Call -- --sample can only be combined with --top, --fold, --utf8 and --only-names\n");
+	} else if (opts -> index && (opts -> merge || opts -> serve != NULL || opts -> sample)) {
+		forceExit("\nInvalid Program Call -- --index and --rows can't be used with --merge, --serve or --sample\n");
+	} else if (opts -> firstRow > 0 && opts -> concurrent) {
+		forceExit("\nInvalid Program Call -- --rows can't be used with --concurrent\n");
+	} else if (opts -> concurrent && !opts -> diff && opts -> dedupColumn != NULL) {
+		// every producer has its own IdSet, so a row re-delivered on another stream would count twice
+		forceExit("\nInvalid Program Call -- --dedup can't be used with --concurrent\n");
+	} else if (opts -> digest != NULL && (opts -> windowSeconds > 0 || opts -> serve != NULL || opts -> sample)) {
+		forceExit("\nInvalid Program Call -- --distribution can't be used with --window, --serve or --sample\n");
+	} else if (opts -> rankPath != NULL && (opts -> windowSeconds > 0 || opts -> maxMemory > 0 || opts -> merge
+			|| opts -> serve != NULL || opts -> sample)) {
+		forceExit("\nInvalid Program Call -- --all can't be used with --window, --max-memory, --merge, --serve or --sample\n");
+	} else if (opts -> quarantine != NULL && (opts -> merge || opts -> serve != NULL || opts -> concurrent || opts -> sample)) {
+		forceExit("\nInvalid Program Call -- --quarantine can't be used with --merge, --serve, --concurrent or --sample\n");
+	} else if (maxErrorRate >= 0 && opts -> quarantine == NULL) {
+		forceExit("\nInvalid Program Call -- --max-error-rate needs --quarantine\n");
+	} else if (opts -> diff && (opts -> fileCount != 2 || opts -> liveSeconds > 0 || opts -> index
+			|| opts -> emitPartial != NULL || opts -> rankPath != NULL || opts -> digest != NULL)) {
+		forceExit("\nInvalid Program Call -- --diff takes two files and can't be used with --live, --index, --emit-partial, --all or --distribution\n");
+	} else if (opts -> buildCache != NULL && (opts -> cache || opts -> windowSeconds > 0 || opts -> dedupColumn != NULL
+			|| opts -> onlyNames != NULL || opts -> fold || opts -> emitPartial != NULL || opts -> maxMemory > 0
+			|| opts -> compact || opts -> pipeline || opts -> merge || opts -> serve != NULL || opts -> concurrent
+			|| opts -> sample || opts -> index || opts -> digest != NULL || opts -> rankPath != NULL || opts -> perf != NULL)) {
+		forceExit("\nInvalid Program Call -- --build-cache can only be combined with --utf8, --quarantine and --max-error-rate\n");
+	} else if (opts -> cache && (opts -> windowSeconds > 0 || opts -> emitPartial != NULL || opts -> maxMemory > 0
+			|| opts -> compact || opts -> pipeline || opts -> merge || opts -> serve != NULL || opts -> concurrent
+			|| opts -> sample || opts -> index || opts -> digest != NULL || opts -> rankPath != NULL || opts -> perf != NULL
+			|| opts -> quarantine != NULL || opts -> utf8Mode != UTF8_OFF)) {
+		forceExit("\nInvalid Program Call -- --cache can only be combined with --top, --fold, --dedup and --only-names\n");
+	} else if (opts -> shardCache != NULL && (opts -> windowSeconds > 0 || opts -> dedupColumn != NULL
+			|| opts -> onlyNames != NULL || opts -> emitPartial != NULL || opts -> maxMemory > 0 || opts -> pipeline
+			|| opts -> merge || opts -> serve != NULL || opts -> concurrent || opts -> sample || opts -> index
+			|| opts -> rankPath != NULL || opts -> perf != NULL || opts -> quarantine != NULL
+			|| opts -> buildCache != NULL || opts -> cache)) {
+		forceExit("\nInvalid Program Call -- --shard-cache can only be combined with --top, --fold, --utf8, --compact, --distribution and --shard-hash\n");
+	} else if (opts -> shardHash && opts -> shardCache == NULL) {
+		forceExit("\nInvalid Program Call -- --shard-hash needs --shard-cache\n");
+	} else if (opts -> publish != NULL && (opts -> windowSeconds > 0 || opts -> maxMemory > 0 || opts -> merge
+			|| opts -> serve != NULL || opts -> concurrent || opts -> sample || opts -> buildCache != NULL
+			|| opts -> cache || opts -> shardCache != NULL)) {
+		forceExit("\nInvalid Program Call -- --publish can't be used with --window, --max-memory, --merge, --serve, --concurrent, --sample, --build-cache, --cache or --shard-cache\n");
+	} else if (opts -> metricsPath != NULL && (opts -> merge || opts -> sample || opts -> buildCache != NULL
+			|| opts -> cache || opts -> shardCache != NULL || opts -> readPublished != NULL)) {
+		forceExit("\nInvalid Program Call -- --metrics can't be used with --merge, --sample, --build-cache, --cache, --shard-cache or --read-published\n");
+	} else if (opts -> liveSeconds > 0 && !opts -> concurrent) {
+		forceExit("\nInvalid Program Call -- --live needs --concurrent\n");
+	}
+	if (maxErrorRate >= 0) opts -> quarantine -> maxRate = maxErrorRate / 100;
+	if (opts -> fileName == NULL && opts -> readPublished == NULL) {
+		forceExit("\nInvalid Program Call -- Usage: ./maxTweeter.exe [options] locationOfCSV\n");
+	} else if (opts -> fileCount > 1 && !opts -> merge && opts -> serve == NULL && !opts -> concurrent
+			&& opts -> shardCache == NULL) {
 		printf("\nMore than one file given -- Only the first file will be run\n");
 	}
 }
 
+/**
+ * @brief Parses a positive number given as an option value
+ * 
+ * @param arg The option value
+ * @param errorMsg Message printed (and program exited) when invalid
+ * @return The parsed number
+ */
+long parseNumberArg(char *arg, char *errorMsg)
+{
+	char *end = NULL;
+	long value = strtol(arg, &end, 10);
+	if (end == arg || *end != '\0' || value <= 0) forceExit(errorMsg);
+	return value;
+}
+
+/**
+ * @brief Parses a positive byte size with an optional K, M or G suffix
+ * 
+ * @param arg The option value
+ * @param errorMsg Message printed (and program exited) when invalid
+ * @return The parsed number of bytes
+ */
+unsigned long parseSizeArg(char *arg, char *errorMsg)
+{
+	char *end = NULL;
+	unsigned long value = strtoul(arg, &end, 10);
+	if (end == arg || value == 0) forceExit(errorMsg);
+	if (*end == 'K' || *end == 'k') {
+		value <<= 10;
+		end++;
+	} else if (*end == 'M' || *end == 'm') {
+		value <<= 20;
+		end++;
+	} else if (*end == 'G' || *end == 'g') {
+		value <<= 30;
+		end++;
+	}
+	if (*end != '\0') forceExit(errorMsg);
+	return value;
+}
+
 /**
  * @brief Checks the file size given to program
  * 
+ * Pipes and other streams have no size up front, so only regular files
+ * are checked; the line limits in processData still apply to them.
+ * 
  * @param fileName The address to where the file is located
  * @return void
  */
 void checkFile(FILE *fileName)
 {
+	struct stat info;
+	if (fstat(fileno(fileName), &info) == 0 && !S_ISREG(info.st_mode)) return;
 	fseek(fileName, 0, SEEK_END);
 	long fileSize = 0;
 	fileSize = ftell(fileName);
@@ -159,7 +1615,7 @@ void checkFile(FILE *fileName)
 int commaCounter(char *line)
 {
 	int count = 0;
-	for (int i = 0; i < strlen(line); i++) {
+	for (int i = 0; line[i] != '\0'; i++) {
 		if (line[i] == ',') {
 			count++;
 		}
@@ -181,16 +1637,23 @@ int commaCounter(char *line)
  * 
  * https://www.gnu.org/software/libc/manual/html_node/Finding-Tokens-in-a-String.html
  *  
+ * Optional columns named in opts (e.g. the dedup id column) are resolved
+ * in the same pass over the header.
+ *
  * @param fileName The address to where the file is located
+ * @param opts Options whose optional column indexes get filled in
  * @return Index of the username column
  */
-int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol)
+int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol, Options *opts)
 {
 	int loopCounter, index, foundName;
 	loopCounter = index = foundName = 0;
 	char buff[MAX_LINE + 1];
-	char *str = strdup(fgets(buff, MAX_LINE + 1, fileName));
+	// streams skip checkFile, so an empty one is only noticed here
+	if (fgets(buff, MAX_LINE + 1, fileName) == NULL) forceExit("\nError: Nothing in CSV file\n");
+	char *str = strdup(buff);
 	*comma = commaCounter(str);
+	if (opts -> buildCache != NULL) opts -> headerLine = strdup(buff);
 	if (strlen(str) == MAX_LINE) {
 		fclose(fileName);
 		free(str);
@@ -224,6 +1687,12 @@ int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol)
 			if (foundName == 1) index = loopCounter;
 			*quoted = 1;
 		}
+		if (opts -> dedupColumn != NULL && matchesColumn(token, opts -> dedupColumn)) {
+			if (opts -> dedupIndex == -1) opts -> dedupIndex = loopCounter;
+		}
+		if (opts -> windowSeconds > 0 && matchesColumn(token, opts -> timeColumn)) {
+			if (opts -> timeIndex == -1) opts -> timeIndex = loopCounter;
+		}
 		token = end;
 		loopCounter++;
 	}
@@ -240,6 +1709,26 @@ int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol)
 	return index;
 }
 
+/**
+ * @brief Checks if a header token names the given column
+ * 
+ * The column may appear bare or wrapped in one level of quotes,
+ * the same way getNameIndex accepts both name and "name". The line
+ * ending left on the last header field is ignored.
+ * 
+ * @param token Header field to be checked
+ * @param column Column name to look for
+ * @return 1 if the token names the column, 0 otherwise
+ */
+int matchesColumn(char *token, char *column)
+{
+	int len = strlen(column);
+	int tokenLen = strcspn(token, "\r\n");
+	if (tokenLen == len && strncmp(token, column, len) == 0) return 1;
+	return tokenLen == len + 2 && token[0] == '"' && strncmp(token + 1, column, len) == 0
+		&& token[len + 1] == '"';
+}
+
 /**
  * @brief Processes data from given CSV file
  * 
@@ -250,43 +1739,264 @@ int getNameIndex(FILE *fileName, int *quoted, int *comma, int *oneCol)
  * It will use a while loop to iterate through each line and add tweet info
  * to the linked list using insertList().
  * 
+ * When dedup is enabled, rows whose id was already seen are skipped before
+ * the name is extracted, so re-delivered rows are never counted twice.
+ * When a watchlist is given, names not on it are dropped right after
+ * extraction, before insertToList allocates anything for them.
+ * In windowed mode rows are counted in the WindowTable instead of the
+ * list, and each window's leaderboard is printed once it closes.
+ * With --pipeline lines come from a BlockReader instead of fgets.
+ * With --perf each row is split into read, tokenize and insert phases,
+ * and with --metrics the same phases are timed into latency histograms.
+ * With --fold names are folded before the watchlist sees them, and a
+ * --serve daemon passes in the watchlist it loaded at startup.
+ * With --rows (or a --concurrent split) it stops after opts -> rowLimit
+ * rows, and with --index invalid rows are reported with their line.
+ * With --quarantine rowError returns after recording an invalid row and
+ * the row is skipped, so every rowError call is followed by a continue.
+ * 
  * @param fileName Address of file location
  * @param namePos Index of NAME value in CSV line 
  * @param info Data struct which contains address of HEAD and TAIL of list
+ * @param opts Options selecting the optional stages
+ * @param summary Counters reported in the run summary
  * @return void
  */
-void processData(FILE *fileName, int namePos, Link *info, int quoted, int comma, int oneCol)
+void processData(FILE *fileName, int namePos, Link *info, int quoted, int comma, int oneCol,
+		Options *opts, Summary *summary)
 {
 	int lineCount = 1;
 	char buff[MAX_LINE + 1];
-	while (!feof(fileName)) {
+	IdSet *ids = NULL;
+	Watchlist *watch = NULL;
+	WindowTable *windows = NULL;
+	long bucket = 0;
+	if (opts -> dedupIndex >= 0) ids = createIdSet();
+	if (opts -> windowSeconds > 0) windows = createWindowTable(opts);
+	BlockReader *reader = NULL;
+	if (opts -> pipeline) reader = createBlockReader(fileName);
+	if (opts -> onlyNames != NULL) {
+		watch = opts -> watchlist != NULL ? opts -> watchlist : loadWatchlist(opts -> onlyNames, opts -> fold);
+		summary -> watchlistSize = watch -> size;
+	}
+	MetricsCounters *metrics = opts -> metricsCounters;
+	while (reader != NULL || !feof(fileName)) {
+		perfPhase(opts -> perf, PHASE_READ);
+		metricsPhase(metrics, PHASE_READ);
+		if (opts -> rowLimit > 0 && lineCount > opts -> rowLimit) break;
 		if (lineCount > MAX_LINE) {
 			freeLinkedMemory(info -> head, info);
 			fclose(fileName);
 			forceExit("\nError: CSV file greater than max line count\n");
 		}
-		char *str = fgets(buff, MAX_LINE + 1, fileName);
-		if (!str) return;	// If EOF, return
+		char *str = NULL;
+		if (reader != NULL) {
+			str = readBlockLine(reader, buff, MAX_LINE + 1);
+		} else {
+			str = fgets(buff, MAX_LINE + 1, fileName);
+		}
+		if (!str) break;	// If EOF, stop reading
+		perfPhase(opts -> perf, PHASE_TOKENIZE);
+		metricsPhase(metrics, PHASE_TOKENIZE);
+		++(summary -> rowsRead);
+		size_t length = strlen(str);
+		summary -> bytesRead += length;
+		if (metrics != NULL) {
+			metricsAdd(&metrics -> rows, 1);
+			metricsAdd(&metrics -> bytes, length);
+		}
+		if (opts -> quarantine != NULL) {
+			memcpy(opts -> quarantine -> line, str, length + 1);
+			// the rest of an overlong line mustn't be read as rows of its own
+			if (length == MAX_LINE && str[length - 1] != '\n') skipLine(fileName, reader);
+		}
 		if (commaCounter(str) != comma) {
-			fclose(fileName);
-			forceExit("\nError: Invalid input format -- wrong number of fields\n");
-		} else if (strlen(str) >= MAX_CHAR) {
+			rowError(fileName, "\nError: Invalid input format -- wrong number of fields\n", opts, lineCount);
+			lineCount++;
+			continue;
+		} else if (length >= MAX_CHAR) {
 			// if line char count > max char count
-			fclose(fileName);
-			forceExit("\nError: Invalid input format -- too many characters in the line\n");
+			rowError(fileName, "\nError: Invalid input format -- too many characters in the line\n", opts, lineCount);
+			lineCount++;
+			continue;
+		}
+		if (opts -> utf8Mode != UTF8_OFF && !validUtf8(str, length)) {
+			if (opts -> utf8Mode == UTF8_REJECT) {
+				rowError(fileName, "\nError: Invalid input format -- malformed UTF-8\n", opts, lineCount);
+				lineCount++;
+				continue;
+			}
+			++(summary -> malformedRows);
+		}
+		int duplicate = ids != NULL ? duplicateRow(str, opts, ids) : 0;
+		if (duplicate == -1) {
+			rowError(fileName, "\nError: Invalid input format -- invalid id found\n", opts, lineCount);
+			lineCount++;
+			continue;
+		} else if (duplicate) {
+			++(summary -> duplicates);
+			lineCount++;
+			continue;
+		}
+		if (windows != NULL) {
+			int length = 0;
+			long seconds = 0;
+			char *field = fieldAt(str, opts -> timeIndex, &length);
+			if (!parseTimestamp(field, length, &seconds)) {
+				rowError(fileName, "\nError: Invalid input format -- invalid timestamp found\n", opts, lineCount);
+				lineCount++;
+				continue;
+			}
+			// floor division so times before 1970 still land in the right bucket
+			bucket = seconds / windows -> bucketSeconds;
+			if (seconds < 0 && seconds % windows -> bucketSeconds != 0) bucket--;
+		}
+		char *error = NULL;
+		char *name = extractName(str, namePos, quoted, &error);
+		if (error != NULL) {
+			rowError(fileName, error, opts, lineCount);
+			lineCount++;
+			continue;
 		}
-		char *name = extractName(str, namePos, quoted, fileName, info);
 		if (oneCol == 1) trimNewLine(name);
+		if (opts -> fold && strcmp(name, "invalid") != 0) foldName(name);
 		if (strcmp(name, "invalid") == 0) {
-			fclose(fileName);
-			forceExit("\nError: Invalid input format -- invalid name found\n");
+			rowError(fileName, "\nError: Invalid input format -- invalid name found\n", opts, lineCount);
+			lineCount++;
+			continue;
 		} else if (*name == '\0') {
 			// If name field is empty string
 			name = "empty";
 		}
-		insertToList(name, info);
+		if (watch != NULL && !watchlistContains(watch, name)) {
+			++(summary -> notWatched);
+			lineCount++;
+			continue;
+		}
+		perfPhase(opts -> perf, PHASE_INSERT);
+		metricsPhase(metrics, PHASE_INSERT);
+		if (windows != NULL) {
+			if (windows -> started && bucket <= windows -> newestBucket - windows -> bucketsPerWindow) {
+				// too old for the ring -- its windows have been printed already
+				++(summary -> lateRows);
+				lineCount++;
+				continue;
+			}
+			while (windows -> started && bucket >= windows -> nextEmit) {
+				if (windows -> nextEmit > windows -> newestBucket + windows -> bucketsPerWindow) {
+					// no rows between the last window and this row -- skip the gap
+					windows -> nextEmit = bucket + 1;
+					break;
+				}
+				emitWindow(windows, windows -> nextEmit, summary);
+			}
+			addToWindow(windows, name, bucket);
+		} else {
+			unsigned long before = info -> bytes;
+			insertToList(name, info);
+			if (metrics != NULL) metricsTable(metrics, info, before);
+		}
+		++(summary -> rowsCounted);
 		lineCount++;
+		if (opts -> publisher != NULL && summary -> rowsRead >= opts -> publisher -> nextRow) {
+			publishTop(opts -> publisher, info, summary, 0);
+		}
+	}
+	// stop the clock, so a --serve daemon's wait for more rows isn't timed as reading
+	metricsPhase(metrics, PHASE_HEADER);
+	if (reader != NULL) freeBlockReader(reader);
+	if (windows != NULL) {
+		finishWindows(windows, summary);
+		freeWindowTable(windows);
+	}
+	if (ids != NULL) freeIdSet(ids);
+	if (watch != NULL && watch != opts -> watchlist) freeWatchlist(watch);
+	// a --serve daemon closes its quarantine once, when it stops
+	if (opts -> quarantine != NULL && opts -> serve == NULL) closeQuarantine(opts -> quarantine, fileName, summary);
+	if (opts -> publisher != NULL) publishTop(opts -> publisher, info, summary, 1);
+}
+
+/**
+ * @brief Checks if a row's id has already been seen
+ * 
+ * duplicateRow reads the dedup column of the line without modifying it,
+ * parses it to a 64-bit id and records it in ids. Rows with an empty id
+ * can't be matched against anything and are never treated as duplicates.
+ * 
+ * @param line Address to CSV line
+ * @param opts Options holding the dedup column index
+ * @param ids Set of ids seen so far
+ * @return 1 if the id was seen before, 0 otherwise, -1 if the id isn't
+ * a valid number (the caller hands the row to rowError)
+ */
+int duplicateRow(char *line, Options *opts, IdSet *ids)
+{
+	int length = 0;
+	uint64_t id = 0;
+	char *field = fieldAt(line, opts -> dedupIndex, &length);
+	if (length == 0) return 0;
+	if (!parseId(field, length, &id)) return -1;
+	return !idSetInsert(ids, id);
+}
+
+/**
+ * @brief Finds a field of a CSV line by index without modifying the line
+ * 
+ * @param line Address to CSV line
+ * @param index Index of the field
+ * @param length Set to the number of chars in the field
+ * @return Address of the first char of the field
+ */
+char *fieldAt(char *line, int index, int *length)
+{
+	char *start = line;
+	for (int i = 0; i < index; i++) {
+		start = strchr(start, ',');
+		if (start == NULL) {
+			*length = 0;
+			return line + strlen(line);
+		}
+		start++;
+	}
+	*length = strcspn(start, ",\r\n");
+	return start;
+}
+
+/**
+ * @brief Parses an unsigned 64-bit id
+ * 
+ * The id may be wrapped in one level of quotes and may carry a leading
+ * minus sign (some exports wrap ids around into negative 32-bit values);
+ * negative ids keep their two's complement bit pattern. Anything other
+ * than decimal digits, or a value which doesn't fit in 64 bits, is invalid.
+ * 
+ * @param field Address of the first char of the id
+ * @param length Number of chars in the id
+ * @param id Set to the parsed value
+ * @return 1 if the id is valid, 0 otherwise
+ */
+int parseId(char *field, int length, uint64_t *id)
+{
+	if (length >= 2 && field[0] == '"' && field[length - 1] == '"') {
+		field++;
+		length -= 2;
 	}
+	int negative = length > 0 && field[0] == '-';
+	if (negative) {
+		field++;
+		length--;
+	}
+	if (length == 0) return 0;
+	uint64_t value = 0;
+	for (int i = 0; i < length; i++) {
+		if (field[i] < '0' || field[i] > '9') return 0;
+		uint64_t digit = field[i] - '0';
+		if (value > (UINT64_MAX - digit) / 10) return 0;
+		value = value * 10 + digit;
+	}
+	if (negative && value > (uint64_t) INT64_MAX + 1) return 0;
+	*id = negative ? 0 - value : value;
+	return 1;
 }
 
 /**
@@ -297,7 +2007,7 @@ void processData(FILE *fileName, int namePos, Link *info, int quoted, int comma,
  * @param counter Address which contains count of commas
  * @return The supposed 'name' string at the index value
  */
-char *extractName(char* str, int namePos, int quoted, FILE *filename, Link *info)
+char *extractName(char* str, int namePos, int quoted, char **error)
 {
 	int index = 0;
 	char *token = str, *end = str, *nameFound = NULL;
@@ -307,8 +2017,8 @@ char *extractName(char* str, int namePos, int quoted, FILE *filename, Link *info
 		if (!nullCheck) return "invalid";
 		if (index == namePos) {
 			nameFound = token;
-			if (quoted == -1) checkQuotes(nameFound, filename, info);
-			if (quoted == 1) stripQuotes(nameFound, filename, info);
+			if (quoted == -1) *error = checkQuotes(nameFound);
+			if (quoted == 1) *error = stripQuotes(nameFound);
 		}
 		token = end;
 		index++;
@@ -327,30 +2037,26 @@ char *extractName(char* str, int namePos, int quoted, FILE *filename, Link *info
  * @brief Checks if there're invalid quotes in NAME field
  * 
  * @param name Pointer to a char array representing NAME
- * @return void
+ * @return The error message if the quotes are invalid, NULL otherwise
  */
-void checkQuotes(char *name, FILE *filename, Link *info)
+char *checkQuotes(char *name)
 {
-	if (name[0] == '"' || name[strlen(name) - 1] == '"') {
-		fclose(filename);
-		forceExit("\nError: Invalid quotes in NAME field\n");
-	}
+	if (name[0] == '"' || name[strlen(name) - 1] == '"') return "\nError: Invalid quotes in NAME field\n";
+	return NULL;
 }
 
 /**
  * @brief Removes the outermost quotes level of a NAME string
  * 
  * @param name Pointer to a char array representing NAME
- * @return void
+ * @return The error message if the quotes are invalid, NULL otherwise
  */
-void stripQuotes(char *name, FILE *filename, Link *info)
+char *stripQuotes(char *name)
 {
 	if (strlen(name) < 2) {
-		fclose(filename);
-		forceExit("\nError: Invalid quotes in NAME field\n");
+		return "\nError: Invalid quotes in NAME field\n";
 	} else if (name[0] != '"' || name[strlen(name) - 1] != '"') {
-		fclose(filename);
-		forceExit("\nError: Mismatching quotes in name field\n");
+		return "\nError: Mismatching quotes in name field\n";
 	}
 	if (strlen(name) >= 3) {
 		int len = strlen(name);
@@ -361,6 +2067,7 @@ void stripQuotes(char *name, FILE *filename, Link *info)
 	} else {
 		name = "";
 	}
+	return NULL;
 }
 
 /**
@@ -422,6 +2129,8 @@ Node *createNode(int initial, Link *info)
  * 
  * It inserts the node into the correct part of the list and
  * calls on createNode for new nodes that need to be created.
+ * With --compact the name is counted in the NameDictionary instead, and
+ * with --concurrent in the SharedTable.
  *
  * @param name Address location of NAME to be used
  * @param info Data struct which contains address of HEAD and TAIL of list
@@ -429,17 +2138,27 @@ Node *createNode(int initial, Link *info)
  */
 void insertToList(char *name, Link *info)
 {
+	if (info -> dict != NULL) {
+		dictionaryAdd(info, name);
+		return;
+	} else if (info -> shared != NULL) {
+		// bytes is what this producer's names take up, for --metrics
+		if (sharedAdd(info -> shared, name, info -> older)) info -> bytes += sizeof(SharedName) + strlen(name) + 1;
+		return;
+	}
 	if (!(info -> head -> user.name)) {
 		// The node list is empty -- we start at item one
 		// HEAD of the list
 		info -> head -> user.count = 1;
 		info -> head -> user.name = allocateName(name, info);
+		info -> bytes += sizeof(Node) + strlen(name) + 1;
 		return;
 	}
 	// There're items in the list -- find the user first
 	int res = findUser(name, info);
 	if (res == -1) {
 		insertAtLast(name, info);
+		if (info -> spill != NULL && info -> bytes > info -> spill -> budget) spillList(info);
 	}
 }
 
@@ -547,6 +2266,7 @@ void insertAtLast(char *name, Link *info)
 	info -> last -> next = newNode;
 	newNode -> prev = info -> last;
 	info -> last = newNode;
+	info -> bytes += sizeof(Node) + strlen(name) + 1;
 }
 
 /**
@@ -561,7 +2281,7 @@ void insertAtLast(char *name, Link *info)
  */
 char *allocateName(char *nameToCopy, Link *info)
 {
-	char *newName = malloc(sizeof(nameToCopy));
+	char *newName = malloc(strlen(nameToCopy) + 1);
 	if (newName == NULL) {
 		forceExit("\nError: Couldn't allocate memory -- NAME field\n");
 	}
@@ -611,3 +2331,5391 @@ void freeLinkedMemory(Node *head, Link *info)
 	}
 	free(info);
 }
+
+/**
+ * @brief Prints the run summary to stderr
+ * 
+ * The summary goes to stderr so the top 10 on stdout keeps its format.
+ * 
+ * @param summary Counters collected by processData
+ * @param opts Options selecting which stage counters are printed
+ * @return void
+ */
+void printSummary(Summary *summary, Options *opts)
+{
+	if (!opts -> merge) fprintf(stderr, "\nRows read: %ld\n", summary -> rowsRead);
+	fprintf(stderr, "%sRows counted: %ld\n", opts -> merge ? "\n" : "", summary -> rowsCounted);
+	if (opts -> dedupIndex >= 0) {
+		fprintf(stderr, "Duplicate rows skipped: %ld\n", summary -> duplicates);
+	}
+	if (opts -> onlyNames != NULL) {
+		fprintf(stderr, "Watchlist names: %lu\n", summary -> watchlistSize);
+		fprintf(stderr, "Rows not on watchlist: %ld\n", summary -> notWatched);
+	}
+	if (opts -> utf8Mode == UTF8_FLAG) {
+		fprintf(stderr, "Rows with malformed UTF-8: %ld\n", summary -> malformedRows);
+	}
+	if (opts -> index) {
+		fprintf(stderr, "Row index: %s (%ld rows)\n", summary -> indexReused ? "reused" : "built", summary -> indexedRows);
+	}
+	if (opts -> sample) {
+		fprintf(stderr, "Blocks sampled: %ld of %ld (%.1f%%)\n", summary -> sampledBlocks, summary -> sampleSlots,
+				summary -> sampleSlots > 0 ? 100.0 * summary -> sampledBlocks / summary -> sampleSlots : 100.0);
+		fprintf(stderr, "Estimated rows: %ld\n", summary -> estimatedRows);
+	}
+	if (opts -> windowSeconds > 0) {
+		fprintf(stderr, "Windows printed: %ld\n", summary -> windowsPrinted);
+		fprintf(stderr, "Late rows dropped: %ld\n", summary -> lateRows);
+	}
+	if (opts -> maxMemory > 0) {
+		fprintf(stderr, "Spilled runs: %d\n", summary -> spilledRuns);
+		if (summary -> spilledRuns > 0) fprintf(stderr, "Distinct names: %lu\n", summary -> partialNames);
+	}
+	if (opts -> merge) {
+		fprintf(stderr, "Partials merged: %ld\n", summary -> partialsMerged);
+		fprintf(stderr, "Distinct names: %lu\n", summary -> partialNames);
+	} else if (opts -> emitPartial != NULL) {
+		fprintf(stderr, "Names in partial: %lu\n", summary -> partialNames);
+	}
+	if (opts -> rankPath != NULL) fprintf(stderr, "Names ranked: %ld\n", summary -> rankedNames);
+	if (opts -> quarantine != NULL) fprintf(stderr, "Rows quarantined: %ld\n", summary -> quarantined);
+	if (opts -> serve != NULL) fprintf(stderr, "Rows rejected: %ld\n", summary -> quarantined);
+	if (opts -> shardCache != NULL) {
+		fprintf(stderr, "Shards reused: %ld of %ld\n", summary -> shardsReused,
+				summary -> shardsReused + summary -> shardsParsed);
+	}
+}
+
+/**
+ * @brief Creates an empty id set
+ * 
+ * @return The pointer to the new set
+ */
+IdSet *createIdSet(void)
+{
+	IdSet *ids = malloc(sizeof(IdSet));
+	if (ids == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Id Set\n");
+	}
+	ids -> capacity = 1024;
+	ids -> size = 0;
+	ids -> hasZero = 0;
+	ids -> slots = calloc(ids -> capacity, sizeof(uint64_t));
+	if (ids -> slots == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Id Set\n");
+	}
+	return ids;
+}
+
+/**
+ * @brief Adds an id to the set
+ * 
+ * Slots are found with Fibonacci hashing (multiply, keep the high bits)
+ * and linear probing. The table doubles once it is half full so probe
+ * chains stay short.
+ * 
+ * @param ids Set to be inserted into
+ * @param id Id to be inserted
+ * @return 1 if the id is new, 0 if it was already in the set
+ */
+int idSetInsert(IdSet *ids, uint64_t id)
+{
+	if (id == 0) {
+		if (ids -> hasZero) return 0;
+		ids -> hasZero = 1;
+		return 1;
+	}
+	if ((ids -> size + 1) * 2 > ids -> capacity) growIdSet(ids);
+	unsigned long mask = ids -> capacity - 1;
+	unsigned long slot = (id * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+	while (ids -> slots[slot] != 0) {
+		if (ids -> slots[slot] == id) return 0;
+		slot = (slot + 1) & mask;
+	}
+	ids -> slots[slot] = id;
+	++(ids -> size);
+	return 1;
+}
+
+/**
+ * @brief Doubles the capacity of the set and re-inserts every id
+ * 
+ * @param ids Set to be grown
+ * @return void
+ */
+void growIdSet(IdSet *ids)
+{
+	uint64_t *old = ids -> slots;
+	unsigned long oldCapacity = ids -> capacity;
+	ids -> capacity = oldCapacity * 2;
+	ids -> slots = calloc(ids -> capacity, sizeof(uint64_t));
+	if (ids -> slots == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Id Set\n");
+	}
+	unsigned long mask = ids -> capacity - 1;
+	for (unsigned long i = 0; i < oldCapacity; i++) {
+		if (old[i] == 0) continue;
+		unsigned long slot = (old[i] * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+		while (ids -> slots[slot] != 0) slot = (slot + 1) & mask;
+		ids -> slots[slot] = old[i];
+	}
+	free(old);
+}
+
+/**
+ * @brief Frees all the memory held by the set
+ * 
+ * @param ids Set to be freed
+ * @return void
+ */
+void freeIdSet(IdSet *ids)
+{
+	free(ids -> slots);
+	free(ids);
+}
+
+/**
+ * @brief Hashes a name with 64-bit FNV-1a
+ * 
+ * @param name Address of the name to be hashed
+ * @return The hash of the name
+ */
+uint64_t hashName(char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned char *c = (unsigned char *) name; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Loads a watchlist file into a Watchlist
+ * 
+ * loadWatchlist reads the whole file into one buffer and turns every line
+ * into a name in place, so no per-name allocation is made. Surrounding
+ * quotes, trailing carriage returns and blank lines are ignored.
+ * 
+ * @param path Location of the watchlist file
+ * @return The pointer to the loaded watchlist
+ */
+Watchlist *loadWatchlist(char *path, int fold)
+{
+	FILE *listFile = fopen(path, "r");
+	if (listFile == NULL) forceExit("\nError: No watchlist file\n");
+	fseek(listFile, 0, SEEK_END);
+	long fileSize = ftell(listFile);
+	fseek(listFile, 0, SEEK_SET);
+	if (fileSize < 0) {
+		fclose(listFile);
+		forceExit("\nError: Couldn't read watchlist file\n");
+	}
+	Watchlist *watch = malloc(sizeof(Watchlist));
+	char *buffer = malloc(fileSize + 1);
+	if (watch == NULL || buffer == NULL) {
+		fclose(listFile);
+		forceExit("\nError: Couldn't allocate memory -- Watchlist\n");
+	}
+	if (fread(buffer, 1, fileSize, listFile) != (size_t) fileSize) {
+		fclose(listFile);
+		forceExit("\nError: Couldn't read watchlist file\n");
+	}
+	fclose(listFile);
+	buffer[fileSize] = '\0';
+	unsigned long lines = 1;
+	for (long i = 0; i < fileSize; i++) {
+		if (buffer[i] == '\n') lines++;
+	}
+	watch -> buffer = buffer;
+	watch -> size = 0;
+	watch -> capacity = 16;
+	while (watch -> capacity < lines * 2) watch -> capacity *= 2;
+	unsigned long bloomBits = 1024;
+	while (bloomBits < lines * 16) bloomBits *= 2;
+	watch -> bloomMask = bloomBits - 1;
+	watch -> bloom = calloc(bloomBits / 64, sizeof(uint64_t));
+	watch -> names = calloc(watch -> capacity, sizeof(char *));
+	watch -> hashes = calloc(watch -> capacity, sizeof(uint64_t));
+	if (watch -> bloom == NULL || watch -> names == NULL || watch -> hashes == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Watchlist\n");
+	}
+	char *line = buffer;
+	while (line != NULL) {
+		char *name = strsep(&line, "\n");
+		int len = strlen(name);
+		if (len > 0 && name[len - 1] == '\r') name[--len] = '\0';
+		if (len >= 2 && name[0] == '"' && name[len - 1] == '"') {
+			name[len - 1] = '\0';
+			name++;
+			len -= 2;
+		}
+		if (fold) foldName(name);
+		if (len > 0) watchlistAdd(watch, name);
+	}
+	return watch;
+}
+
+/**
+ * @brief Adds a name to the watchlist
+ * 
+ * Each name sets three Bloom filter bits, derived from its hash with
+ * double hashing, and takes one slot in the exact table.
+ * 
+ * @param watch Watchlist to be added to
+ * @param name Address of the name (must outlive the watchlist)
+ * @return 1 if the name is new, 0 if it was already listed
+ */
+int watchlistAdd(Watchlist *watch, char *name)
+{
+	uint64_t hash = hashName(name);
+	unsigned long mask = watch -> capacity - 1;
+	unsigned long slot = hash & mask;
+	while (watch -> names[slot] != NULL) {
+		if (watch -> hashes[slot] == hash && strcmp(watch -> names[slot], name) == 0) return 0;
+		slot = (slot + 1) & mask;
+	}
+	watch -> names[slot] = name;
+	watch -> hashes[slot] = hash;
+	++(watch -> size);
+	uint64_t h1 = hash >> 32, h2 = (hash & 0xffffffffULL) | 1;
+	for (int i = 0; i < 3; i++) {
+		unsigned long bit = (h1 + i * h2) & watch -> bloomMask;
+		watch -> bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+	return 1;
+}
+
+/**
+ * @brief Checks if a name is on the watchlist
+ * 
+ * @param watch Watchlist to be searched
+ * @param name Address of the name to be found
+ * @return 1 if the name is listed, 0 otherwise
+ */
+int watchlistContains(Watchlist *watch, char *name)
+{
+	uint64_t hash = hashName(name);
+	uint64_t h1 = hash >> 32, h2 = (hash & 0xffffffffULL) | 1;
+	for (int i = 0; i < 3; i++) {
+		unsigned long bit = (h1 + i * h2) & watch -> bloomMask;
+		if (!(watch -> bloom[bit / 64] & (1ULL << (bit % 64)))) return 0;
+	}
+	unsigned long mask = watch -> capacity - 1;
+	unsigned long slot = hash & mask;
+	while (watch -> names[slot] != NULL) {
+		if (watch -> hashes[slot] == hash && strcmp(watch -> names[slot], name) == 0) return 1;
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+/**
+ * @brief Frees all the memory held by the watchlist
+ * 
+ * @param watch Watchlist to be freed
+ * @return void
+ */
+void freeWatchlist(Watchlist *watch)
+{
+	free(watch -> bloom);
+	free(watch -> names);
+	free(watch -> hashes);
+	free(watch -> buffer);
+	free(watch);
+}
+
+/**
+ * @brief Parses a fixed-format timestamp into seconds since the epoch
+ * 
+ * parseTimestamp reads the `YYYY-MM-DD HH:MM:SS` layout used by the
+ * tweet_created column by fixed offsets, with an optional ` +HHMM` or
+ * ` -HHMM` UTC offset, and may be wrapped in one level of quotes. The
+ * date is turned into days with the days-from-civil formula rather than
+ * mktime, which avoids the time zone machinery entirely.
+ * 
+ * @param field Address of the first char of the timestamp
+ * @param length Number of chars in the timestamp
+ * @param seconds Set to the UTC time in seconds since 1970-01-01
+ * @return 1 if the timestamp is valid, 0 otherwise
+ */
+int parseTimestamp(char *field, int length, long *seconds)
+{
+	static const char layout[] = "dddd-dd-dd dd:dd:dd";
+	if (length >= 2 && field[0] == '"' && field[length - 1] == '"') {
+		field++;
+		length -= 2;
+	}
+	if (length != 19 && length != 25) return 0;
+	for (int i = 0; i < 19; i++) {
+		if (layout[i] == 'd' ? (field[i] < '0' || field[i] > '9') : field[i] != layout[i]) return 0;
+	}
+	long year = (field[0] - '0') * 1000 + (field[1] - '0') * 100 + (field[2] - '0') * 10 + (field[3] - '0');
+	int month = (field[5] - '0') * 10 + (field[6] - '0');
+	int day = (field[8] - '0') * 10 + (field[9] - '0');
+	int hour = (field[11] - '0') * 10 + (field[12] - '0');
+	int minute = (field[14] - '0') * 10 + (field[15] - '0');
+	int second = (field[17] - '0') * 10 + (field[18] - '0');
+	if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return 0;
+	long offset = 0;
+	if (length == 25) {
+		char *zone = field + 19;
+		if (zone[0] != ' ' || (zone[1] != '+' && zone[1] != '-')) return 0;
+		for (int i = 2; i < 6; i++) {
+			if (zone[i] < '0' || zone[i] > '9') return 0;
+		}
+		offset = ((zone[2] - '0') * 10 + (zone[3] - '0')) * 3600 + ((zone[4] - '0') * 10 + (zone[5] - '0')) * 60;
+		if (zone[1] == '-') offset = -offset;
+	}
+	// days-from-civil: count from 0000-03-01 so the leap day ends the year
+	year -= month <= 2;
+	long era = year / 400;
+	long yearOfEra = year - era * 400;
+	long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	long days = era * 146097 + dayOfEra - 719468;
+	*seconds = days * 86400 + hour * 3600 + minute * 60 + second - offset;
+	return 1;
+}
+
+/**
+ * @brief Creates an empty windowed leaderboard
+ * 
+ * @param opts Options holding the window, slide and top count
+ * @return The pointer to the new table
+ */
+WindowTable *createWindowTable(Options *opts)
+{
+	WindowTable *windows = malloc(sizeof(WindowTable));
+	if (windows == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+	}
+	windows -> bucketSeconds = opts -> slideSeconds;
+	windows -> bucketsPerWindow = opts -> windowSeconds / opts -> slideSeconds;
+	windows -> topCount = opts -> topCount;
+	windows -> started = 0;
+	windows -> newestBucket = 0;
+	windows -> nextEmit = 0;
+	windows -> size = 0;
+	windows -> allocated = 64;
+	windows -> capacity = 128;
+	windows -> keys = malloc(windows -> allocated * sizeof(WindowKey));
+	windows -> slots = malloc(windows -> capacity * sizeof(long));
+	if (windows -> keys == NULL || windows -> slots == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+	}
+	for (unsigned long i = 0; i < windows -> capacity; i++) windows -> slots[i] = -1;
+	return windows;
+}
+
+/**
+ * @brief Counts one row for a tweeter in the given bucket
+ * 
+ * addToWindow finds (or creates) the tweeter's ring and moves it forward
+ * to the row's bucket, zeroing every bucket that fell out of the window
+ * on the way, before incrementing the row's bucket.
+ * 
+ * @param windows Windowed leaderboard
+ * @param name Address location of NAME to be used
+ * @param bucket Bucket (time / slide) of the row
+ * @return void
+ */
+void addToWindow(WindowTable *windows, char *name, long bucket)
+{
+	int ring = windows -> bucketsPerWindow;
+	if (!windows -> started) {
+		windows -> started = 1;
+		windows -> newestBucket = bucket;
+		windows -> nextEmit = bucket + 1;
+	} else if (bucket > windows -> newestBucket) {
+		windows -> newestBucket = bucket;
+	}
+	uint64_t hash = hashName(name);
+	unsigned long mask = windows -> capacity - 1;
+	unsigned long slot = hash & mask;
+	WindowKey *key = NULL;
+	while (windows -> slots[slot] != -1) {
+		WindowKey *candidate = &windows -> keys[windows -> slots[slot]];
+		if (candidate -> hash == hash && strcmp(candidate -> name, name) == 0) {
+			key = candidate;
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	if (key == NULL) {
+		if (windows -> size == windows -> allocated) {
+			windows -> allocated *= 2;
+			windows -> keys = realloc(windows -> keys, windows -> allocated * sizeof(WindowKey));
+			if (windows -> keys == NULL) {
+				forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+			}
+		}
+		key = &windows -> keys[windows -> size];
+		key -> name = strdup(name);
+		key -> counts = calloc(ring, sizeof(int));
+		if (key -> name == NULL || key -> counts == NULL) {
+			forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+		}
+		key -> hash = hash;
+		key -> lastBucket = bucket;
+		key -> total = 0;
+		windows -> slots[slot] = windows -> size;
+		++(windows -> size);
+		if (windows -> size * 2 > windows -> capacity) {
+			windows -> capacity *= 2;
+			rebuildWindowSlots(windows);
+			key = &windows -> keys[windows -> size - 1];
+		}
+	}
+	if (bucket > key -> lastBucket) {
+		long steps = bucket - key -> lastBucket;
+		if (steps > ring) steps = ring;
+		for (long b = bucket - steps + 1; b <= bucket; b++) {
+			int *cell = &key -> counts[((b % ring) + ring) % ring];
+			key -> total -= *cell;
+			*cell = 0;
+		}
+		key -> lastBucket = bucket;
+	}
+	++(key -> counts[((bucket % ring) + ring) % ring]);
+	++(key -> total);
+}
+
+/**
+ * @brief Prints the leaderboard of the window ending at endBucket
+ * 
+ * The window covers buckets [endBucket - bucketsPerWindow, endBucket).
+ * Each tweeter's count in it is its ring total minus the buckets older
+ * than the window's start. Afterwards nextEmit moves one slide forward
+ * and tweeters which can't appear in any later window are evicted.
+ * 
+ * @param windows Windowed leaderboard
+ * @param endBucket First bucket after the window
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void emitWindow(WindowTable *windows, long endBucket, Summary *summary)
+{
+	int ring = windows -> bucketsPerWindow;
+	long startBucket = endBucket - ring;
+	Tweeter *top = malloc(windows -> topCount * sizeof(Tweeter));
+	if (top == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+	}
+	int topSize = 0;
+	for (unsigned long i = 0; i < windows -> size; i++) {
+		WindowKey *key = &windows -> keys[i];
+		if (key -> lastBucket < startBucket) continue;
+		long count = key -> total;
+		for (long b = key -> lastBucket - ring + 1; b < startBucket; b++) {
+			count -= key -> counts[((b % ring) + ring) % ring];
+		}
+		if (count > 0) updateTop(top, &topSize, windows -> topCount, key -> name, count);
+	}
+	if (topSize > 0) {
+		char start[32], end[32];
+		time_t startTime = startBucket * windows -> bucketSeconds;
+		time_t endTime = endBucket * windows -> bucketSeconds;
+		struct tm parts;
+		strftime(start, sizeof(start), "%Y-%m-%d %H:%M:%S", gmtime_r(&startTime, &parts));
+		strftime(end, sizeof(end), "%Y-%m-%d %H:%M:%S", gmtime_r(&endTime, &parts));
+		printf("%sWindow %s -- %s +0000\n", summary -> windowsPrinted > 0 ? "\n" : "", start, end);
+		for (int i = 0; i < topSize; i++) {
+			printf("%s: %d\n", top[i].name, top[i].count);
+		}
+		++(summary -> windowsPrinted);
+	}
+	free(top);
+	windows -> nextEmit = endBucket + 1;
+	evictWindowKeys(windows, windows -> nextEmit - ring);
+}
+
+/**
+ * @brief Prints every window which still holds rows once input ends
+ * 
+ * @param windows Windowed leaderboard
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void finishWindows(WindowTable *windows, Summary *summary)
+{
+	if (!windows -> started) return;
+	long lastEnd = windows -> newestBucket + windows -> bucketsPerWindow;
+	while (windows -> nextEmit <= lastEnd && windows -> size > 0) {
+		emitWindow(windows, windows -> nextEmit, summary);
+	}
+}
+
+/**
+ * @brief Drops tweeters whose newest row is older than every live window
+ * 
+ * Keeps the table bounded by the tweeters active within one window
+ * rather than every tweeter ever seen.
+ * 
+ * @param windows Windowed leaderboard
+ * @param oldestLiveBucket First bucket of the next window
+ * @return void
+ */
+void evictWindowKeys(WindowTable *windows, long oldestLiveBucket)
+{
+	unsigned long kept = 0;
+	for (unsigned long i = 0; i < windows -> size; i++) {
+		WindowKey *key = &windows -> keys[i];
+		if (key -> lastBucket < oldestLiveBucket) {
+			free(key -> name);
+			free(key -> counts);
+		} else {
+			windows -> keys[kept++] = *key;
+		}
+	}
+	if (kept == windows -> size) return;
+	windows -> size = kept;
+	rebuildWindowSlots(windows);
+}
+
+/**
+ * @brief Re-indexes every key after the key array or capacity changed
+ * 
+ * @param windows Windowed leaderboard
+ * @return void
+ */
+void rebuildWindowSlots(WindowTable *windows)
+{
+	windows -> slots = realloc(windows -> slots, windows -> capacity * sizeof(long));
+	if (windows -> slots == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Window Table\n");
+	}
+	for (unsigned long i = 0; i < windows -> capacity; i++) windows -> slots[i] = -1;
+	unsigned long mask = windows -> capacity - 1;
+	for (unsigned long i = 0; i < windows -> size; i++) {
+		unsigned long slot = windows -> keys[i].hash & mask;
+		while (windows -> slots[slot] != -1) slot = (slot + 1) & mask;
+		windows -> slots[slot] = i;
+	}
+}
+
+/**
+ * @brief Frees all the memory held by the windowed leaderboard
+ * 
+ * @param windows Windowed leaderboard
+ * @return void
+ */
+void freeWindowTable(WindowTable *windows)
+{
+	for (unsigned long i = 0; i < windows -> size; i++) {
+		free(windows -> keys[i].name);
+		free(windows -> keys[i].counts);
+	}
+	free(windows -> keys);
+	free(windows -> slots);
+	free(windows);
+}
+
+/**
+ * @brief Offers a tweeter to a bounded, descending top list
+ * 
+ * top holds at most limit entries sorted by count. A tweeter only
+ * displaces an entry with a strictly lower count, so ties keep the
+ * tweeter that was offered first. The name is borrowed, not copied.
+ * 
+ * @param top Array of at least limit entries
+ * @param size Number of entries currently in top
+ * @param limit Maximum number of entries
+ * @param name Address of the tweeter's name
+ * @param count The tweeter's count
+ * @return void
+ */
+void updateTop(Tweeter *top, int *size, int limit, char *name, int count)
+{
+	if (*size == limit && top[limit - 1].count >= count) return;
+	int i = (*size < limit) ? (*size)++ : limit - 1;
+	while (i > 0 && top[i - 1].count < count) {
+		top[i] = top[i - 1];
+		i--;
+	}
+	top[i].name = name;
+	top[i].count = count;
+}
+
+/**
+ * @brief Copies every tweeter in the list into an array
+ * 
+ * The names are borrowed from the list, so the array must not outlive it.
+ * 
+ * @param info Data struct which contains address of HEAD and TAIL of list
+ * @param size Set to the number of tweeters copied
+ * @return The array of tweeters (to be freed by the caller)
+ */
+Tweeter *collectTweeters(Link *info, long *size)
+{
+	NameDictionary *dict = info -> dict;
+	if (dict != NULL) {
+		Tweeter *tweeters = malloc((dict -> size > 0 ? dict -> size : 1) * sizeof(Tweeter));
+		if (tweeters == NULL) {
+			forceExit("\nError: Couldn't allocate memory -- Tweeter Array\n");
+		}
+		for (unsigned long id = 0; id < dict -> size; id++) {
+			tweeters[id].name = dict -> arena + dict -> offsets[id];
+			tweeters[id].count = dict -> counts[id];
+		}
+		*size = dict -> size;
+		return tweeters;
+	}
+	if (info -> shared != NULL) {
+		SharedTable *table = info -> shared;
+		Tweeter *tweeters = malloc((atomic_load(&table -> size) + 1) * sizeof(Tweeter));
+		if (tweeters == NULL) {
+			forceExit("\nError: Couldn't allocate memory -- Tweeter Array\n");
+		}
+		long i = 0;
+		for (unsigned long b = 0; b <= table -> mask; b++) {
+			for (SharedName *entry = atomic_load(&table -> buckets[b]); entry != NULL; entry = atomic_load(&entry -> next)) {
+				tweeters[i].name = entry -> name;
+				tweeters[i++].count = atomic_load(&entry -> count);
+			}
+		}
+		*size = i;
+		return tweeters;
+	}
+	long total = 0;
+	for (Node *current = info -> head; current != NULL; current = current -> next) {
+		if (current -> user.name != NULL) total++;
+	}
+	Tweeter *tweeters = malloc((total > 0 ? total : 1) * sizeof(Tweeter));
+	if (tweeters == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Tweeter Array\n");
+	}
+	long i = 0;
+	for (Node *current = info -> head; current != NULL; current = current -> next) {
+		if (current -> user.name != NULL) tweeters[i++] = current -> user;
+	}
+	*size = total;
+	return tweeters;
+}
+
+/**
+ * @brief qsort comparator ordering tweeters by name
+ * 
+ * @param left Address of the first Tweeter
+ * @param right Address of the second Tweeter
+ * @return strcmp of the two names
+ */
+int compareTweeterNames(const void *left, const void *right)
+{
+	return strcmp(((const Tweeter *) left) -> name, ((const Tweeter *) right) -> name);
+}
+
+/**
+ * @brief Writes an unsigned LEB128 varint
+ * 
+ * @param out File to be written to
+ * @param value Value to be written
+ * @return void
+ */
+void writeVarint(FILE *out, uint64_t value)
+{
+	while (value >= 0x80) {
+		putc((int) (value & 0x7f) | 0x80, out);
+		value >>= 7;
+	}
+	putc((int) value, out);
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ * 
+ * @param in File to be read from
+ * @param value Set to the value read
+ * @return 1 on success, 0 on end of file or an overlong varint
+ */
+int readVarint(FILE *in, uint64_t *value)
+{
+	uint64_t result = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int byte = getc(in);
+		if (byte == EOF) return 0;
+		result |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Writes the header of a partial result file
+ * 
+ * @param out File to be written to
+ * @param names Number of records which follow
+ * @param rows Number of rows counted into those records
+ * @return void
+ */
+void partialHeader(FILE *out, uint64_t names, uint64_t rows)
+{
+	uint32_t version = PARTIAL_VERSION;
+	fwrite(PARTIAL_MAGIC, 1, 4, out);
+	fwrite(&version, sizeof(version), 1, out);
+	fwrite(&names, sizeof(names), 1, out);
+	fwrite(&rows, sizeof(rows), 1, out);
+}
+
+/**
+ * @brief Writes one front-coded record of a partial result file
+ * 
+ * @param out File to be written to
+ * @param name Name of the record
+ * @param previous Name of the previous record ("" for the first)
+ * @param count Count of the record
+ * @return void
+ */
+void partialRecord(FILE *out, char *name, char *previous, uint64_t count)
+{
+	int shared = 0;
+	while (name[shared] != '\0' && name[shared] == previous[shared]) shared++;
+	int suffix = strlen(name + shared);
+	writeVarint(out, shared);
+	writeVarint(out, suffix);
+	fwrite(name + shared, 1, suffix, out);
+	writeVarint(out, count);
+}
+
+/**
+ * @brief Writes the whole count table as a partial result file
+ * 
+ * The tweeters are sorted by name so partials can be merged in one
+ * streaming pass, and so consecutive names share prefixes for the
+ * front coding. A --shard-cache entry is left in first-seen order
+ * instead: it is only read back whole, and the order keeps the ties of
+ * a reused shard where a parsed one puts them.
+ * 
+ * @param path Location of the partial file
+ * @param key --shard-cache key written ahead of the partial, NULL for a plain partial
+ * @param info Data struct which contains address of HEAD and TAIL of list
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void writePartial(char *path, ShardKey *key, Link *info, Summary *summary)
+{
+	long size = 0;
+	Tweeter *tweeters = collectTweeters(info, &size);
+	if (key == NULL) qsort(tweeters, size, sizeof(Tweeter), compareTweeterNames);
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) forceExit("\nError: Couldn't open partial file\n");
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+	if (key != NULL) fwrite(key, sizeof(ShardKey), 1, out);
+	partialHeader(out, size, summary -> rowsCounted);
+	char *previous = "";
+	for (long i = 0; i < size; i++) {
+		partialRecord(out, tweeters[i].name, previous, tweeters[i].count);
+		previous = tweeters[i].name;
+	}
+	if (fclose(out) != 0) forceExit("\nError: Couldn't write partial file\n");
+	summary -> partialNames = size;
+	free(tweeters);
+}
+
+/**
+ * @brief Opens a partial result file and reads its header
+ * 
+ * @param reader Reader to be set up
+ * @param path Location of the partial file
+ * @param offset Where the partial starts in the file (0 unless it is a spill run)
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void openPartial(PartialReader *reader, char *path, long offset, Summary *summary)
+{
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t rows = 0;
+	reader -> file = fopen(path, "rb");
+	if (reader -> file == NULL && errno == ENOENT) {
+		forceExit("\nError: No partial file\n");
+	} else if (reader -> file == NULL) {
+		char message[MAX_CHAR];
+		snprintf(message, sizeof(message), "\nError: Couldn't open partial file -- %s\n", strerror(errno));
+		forceExit(message);
+	}
+	setvbuf(reader -> file, NULL, _IOFBF, 1 << 16);
+	if (offset > 0) fseek(reader -> file, offset, SEEK_SET);
+	if (fread(magic, 1, 4, reader -> file) != 4 || memcmp(magic, PARTIAL_MAGIC, 4) != 0) {
+		forceExit("\nError: Not a partial result file\n");
+	}
+	if (fread(&version, sizeof(version), 1, reader -> file) != 1 || version != PARTIAL_VERSION) {
+		forceExit("\nError: Unsupported partial result version\n");
+	}
+	if (fread(&reader -> remaining, sizeof(uint64_t), 1, reader -> file) != 1
+			|| fread(&rows, sizeof(rows), 1, reader -> file) != 1) {
+		forceExit("\nError: Truncated partial result file\n");
+	}
+	reader -> name[0] = '\0';
+	reader -> length = 0;
+	reader -> unordered = 0;
+	summary -> rowsCounted += rows;
+}
+
+/**
+ * @brief Moves a reader to its next record
+ * 
+ * Records must be in strictly increasing strcmp order, otherwise the
+ * merge could miss equal names, so anything else is rejected unless the
+ * reader is unordered.
+ * 
+ * @param reader Reader to be advanced
+ * @return 1 if a record was read, 0 once the file is exhausted
+ */
+int nextPartialRecord(PartialReader *reader)
+{
+	uint64_t shared = 0, suffix = 0;
+	if (reader -> remaining == 0) return 0;
+	char previous[MAX_CHAR];
+	memcpy(previous, reader -> name, reader -> length + 1);
+	if (!readVarint(reader -> file, &shared) || !readVarint(reader -> file, &suffix)
+			|| shared > (uint64_t) reader -> length || shared + suffix >= MAX_CHAR
+			|| fread(reader -> name + shared, 1, suffix, reader -> file) != suffix
+			|| !readVarint(reader -> file, &reader -> count)) {
+		forceExit("\nError: Truncated partial result file\n");
+	}
+	reader -> length = shared + suffix;
+	reader -> name[reader -> length] = '\0';
+	if ((int) strlen(reader -> name) != reader -> length
+			|| (!reader -> unordered && previous[0] != '\0' && strcmp(previous, reader -> name) >= 0)) {
+		forceExit("\nError: Partial result file is not sorted\n");
+	}
+	--(reader -> remaining);
+	return 1;
+}
+
+/**
+ * @brief Restores the min-heap order of readers below index
+ * 
+ * @param heap Array of readers ordered by their current name
+ * @param size Number of readers in the heap
+ * @param index Position of the reader which may be out of order
+ * @return void
+ */
+void siftDownReaders(PartialReader **heap, int size, int index)
+{
+	while (1) {
+		int smallest = index, left = 2 * index + 1, right = 2 * index + 2;
+		if (left < size && strcmp(heap[left] -> name, heap[smallest] -> name) < 0) smallest = left;
+		if (right < size && strcmp(heap[right] -> name, heap[smallest] -> name) < 0) smallest = right;
+		if (smallest == index) return;
+		PartialReader *tmp = heap[index];
+		heap[index] = heap[smallest];
+		heap[smallest] = tmp;
+		index = smallest;
+	}
+}
+
+/**
+ * @brief Merges sorted partial readers into one stream of totals
+ * 
+ * mergeReaders runs a k-way merge with a min-heap of readers: equal names
+ * surface together at the top of the heap and their counts are summed,
+ * so only one record per input is in memory at a time. Every total is
+ * offered to top (unless it is NULL), and written to out when it isn't
+ * NULL. Readers are closed once exhausted.
+ * 
+ * @param readers Opened readers, each positioned before its first record
+ * @param count Number of readers
+ * @param out Partial file the merged records are written to, or NULL
+ * @param top Array of at least limit entries owning their names, or NULL
+ * @param topSize Number of entries currently in top
+ * @param limit Maximum number of entries in top
+ * @param names Incremented once per distinct name
+ * @param digest Sketch every total is added to, or NULL
+ * @return void
+ */
+void mergeReaders(PartialReader *readers, int count, FILE *out, Tweeter *top, int *topSize, int limit,
+		unsigned long *names, TDigest *digest)
+{
+	int size = 0;
+	PartialReader **heap = malloc((count > 0 ? count : 1) * sizeof(PartialReader *));
+	if (heap == NULL) forceExit("\nError: Couldn't allocate memory -- Merge\n");
+	for (int i = 0; i < count; i++) {
+		if (nextPartialRecord(&readers[i])) {
+			heap[size++] = &readers[i];
+		} else {
+			fclose(readers[i].file);
+		}
+	}
+	for (int i = size / 2 - 1; i >= 0; i--) siftDownReaders(heap, size, i);
+	char previous[MAX_CHAR] = "";
+	char name[MAX_CHAR];
+	while (size > 0) {
+		uint64_t total = 0;
+		strcpy(name, heap[0] -> name);
+		while (size > 0 && strcmp(heap[0] -> name, name) == 0) {
+			total += heap[0] -> count;
+			if (!nextPartialRecord(heap[0])) {
+				fclose(heap[0] -> file);
+				heap[0] = heap[--size];
+			}
+			siftDownReaders(heap, size, 0);
+		}
+		if (total > INT32_MAX) forceExit("\nError: Merged count too large\n");
+		++(*names);
+		if (digest != NULL) digestAdd(digest, total);
+		if (out != NULL) {
+			partialRecord(out, name, previous, total);
+			strcpy(previous, name);
+		}
+		if (top != NULL && (*topSize < limit || top[*topSize - 1].count < (int) total)) {
+			// updateTop borrows names, so the top list keeps its own copies
+			if (*topSize == limit) free(top[*topSize - 1].name);
+			char *copy = strdup(name);
+			if (copy == NULL) forceExit("\nError: Couldn't allocate memory -- Merge\n");
+			updateTop(top, topSize, limit, copy, total);
+		}
+	}
+	free(heap);
+}
+
+/**
+ * @brief Prints a top list built by mergeReaders and frees its names
+ * 
+ * @param top Array of tweeters owning their names
+ * @param size Number of entries in top
+ * @return void
+ */
+void printTop(Tweeter *top, int size)
+{
+	for (int i = 0; i < size; i++) {
+		printf("%s: %d\n", top[i].name, top[i].count);
+		free(top[i].name);
+	}
+}
+
+/**
+ * @brief Merges partial result files and prints the combined top list
+ * 
+ * No CSV is re-parsed: the sorted partials are streamed through
+ * mergeReaders. With --emit-partial the merged table is also written as
+ * a new partial, which allows merging in a tree.
+ * 
+ * @param opts Options holding the partial files and top count
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void mergePartials(Options *opts, Summary *summary)
+{
+	PartialReader *readers = malloc(opts -> fileCount * sizeof(PartialReader));
+	Tweeter *top = malloc(opts -> topCount * sizeof(Tweeter));
+	if (readers == NULL || top == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Merge\n");
+	}
+	for (int i = 0; i < opts -> fileCount; i++) {
+		openPartial(&readers[i], opts -> files[i], 0, summary);
+	}
+	summary -> partialsMerged = opts -> fileCount;
+	FILE *out = NULL;
+	if (opts -> emitPartial != NULL) {
+		out = fopen(opts -> emitPartial, "wb");
+		if (out == NULL) forceExit("\nError: Couldn't open partial file\n");
+		setvbuf(out, NULL, _IOFBF, 1 << 16);
+		// the name count is patched in once the merge knows it
+		partialHeader(out, 0, summary -> rowsCounted);
+	}
+	int topSize = 0;
+	mergeReaders(readers, opts -> fileCount, out, top, &topSize, opts -> topCount, &summary -> partialNames, opts -> digest);
+	if (out != NULL) {
+		uint64_t names = summary -> partialNames;
+		fseek(out, 8, SEEK_SET);
+		fwrite(&names, sizeof(names), 1, out);
+		if (fclose(out) != 0) forceExit("\nError: Couldn't write partial file\n");
+	}
+	printTop(top, topSize);
+	free(top);
+	free(readers);
+}
+
+/**
+ * @brief Creates the spill state for a count table budget
+ * 
+ * No file is created until the table is spilled for the first time.
+ * 
+ * @param budget Bytes the count table may use before it is spilled
+ * @return The pointer to the new spill state
+ */
+Spill *createSpill(unsigned long budget)
+{
+	Spill *spill = malloc(sizeof(Spill));
+	if (spill == NULL) forceExit("\nError: Couldn't allocate memory -- Spill\n");
+	spill -> budget = budget;
+	spill -> runs = 0;
+	spill -> offsets = NULL;
+	return spill;
+}
+
+/**
+ * @brief Creates the temporary partition files for spilling
+ * 
+ * The files are created in $TMPDIR (or /tmp) and removed by finishSpill.
+ * 
+ * @param spill Spill state the files belong to
+ * @return void
+ */
+void openSpillFiles(Spill *spill)
+{
+	for (int p = 0; p < SPILL_PARTITIONS; p++) spill -> files[p] = createSpillFile(&spill -> paths[p]);
+}
+
+/**
+ * @brief Creates one temporary spill file in $TMPDIR (or /tmp)
+ * 
+ * @param path Set to the file's location (to be freed by the caller)
+ * @return The file, open for writing
+ */
+FILE *createSpillFile(char **path)
+{
+	char *dir = getenv("TMPDIR");
+	if (dir == NULL || *dir == '\0') dir = "/tmp";
+	*path = malloc(strlen(dir) + 32);
+	if (*path == NULL) forceExit("\nError: Couldn't allocate memory -- Spill\n");
+	sprintf(*path, "%s/maxTweeter-spill-XXXXXX", dir);
+	int fd = mkstemp(*path);
+	FILE *file = fd != -1 ? fdopen(fd, "wb") : NULL;
+	if (file == NULL) forceExit("\nError: Couldn't create spill file\n");
+	setvbuf(file, NULL, _IOFBF, 1 << 16);
+	return file;
+}
+
+/**
+ * @brief Writes the whole count table to disk and empties it
+ * 
+ * The tweeters are sorted by name and every partition file gets one run
+ * holding the names which hash to it, so a name's counts from different
+ * spills always end up in the same partition.
+ * 
+ * @param info Data struct which contains address of HEAD and TAIL of list
+ * @return void
+ */
+void spillList(Link *info)
+{
+	Spill *spill = info -> spill;
+	if (spill -> runs == 0) openSpillFiles(spill);
+	long size = 0;
+	Tweeter *tweeters = collectTweeters(info, &size);
+	qsort(tweeters, size, sizeof(Tweeter), compareTweeterNames);
+	unsigned char *partition = malloc(size > 0 ? size : 1);
+	long *offsets = realloc(spill -> offsets, (spill -> runs + 1) * SPILL_PARTITIONS * sizeof(long));
+	if (partition == NULL || offsets == NULL) forceExit("\nError: Couldn't allocate memory -- Spill\n");
+	spill -> offsets = offsets;
+	uint64_t sizes[SPILL_PARTITIONS] = { 0 };
+	for (long i = 0; i < size; i++) {
+		partition[i] = hashName(tweeters[i].name) % SPILL_PARTITIONS;
+		++sizes[partition[i]];
+	}
+	for (int p = 0; p < SPILL_PARTITIONS; p++) {
+		FILE *out = spill -> files[p];
+		offsets[spill -> runs * SPILL_PARTITIONS + p] = ftell(out);
+		partialHeader(out, sizes[p], 0);
+		char *previous = "";
+		for (long i = 0; i < size; i++) {
+			if (partition[i] != p) continue;
+			partialRecord(out, tweeters[i].name, previous, tweeters[i].count);
+			previous = tweeters[i].name;
+		}
+		if (ferror(out)) forceExit("\nError: Couldn't write spill file\n");
+	}
+	++(spill -> runs);
+	free(partition);
+	free(tweeters);
+	resetList(info);
+}
+
+/**
+ * @brief Frees every node of the list and starts over with an empty HEAD
+ * 
+ * @param info Data struct which contains address of HEAD and TAIL of list
+ * @return void
+ */
+void resetList(Link *info)
+{
+	if (info -> dict != NULL) {
+		freeDictionary(info -> dict);
+		info -> dict = createDictionary();
+		info -> bytes = 0;
+		return;
+	}
+	Node *head = info -> head;
+	while (head != NULL) {
+		Node *tmp = head;
+		head = head -> next;
+		free(tmp -> user.name);
+		free(tmp);
+	}
+	info -> head = createNode(1, info);
+	info -> last = info -> head;
+	info -> bytes = 0;
+}
+
+/**
+ * @brief Merges the spilled runs into exact totals and prints the top list
+ * 
+ * What is left in memory is spilled as a final run first. Partitions are
+ * independent, so each one is merged on its own. With --emit-partial
+ * every run of every partition is merged together instead, since a
+ * partial needs all names in one sorted order. Either way reduceRuns
+ * first merges the runs in passes of SPILL_FAN_IN, so the open files
+ * stay bounded however many times the table was spilled.
+ * 
+ * @param info Data struct which contains address of HEAD and TAIL of list
+ * @param opts Options holding the top count and --emit-partial
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void finishSpill(Link *info, Options *opts, Summary *summary)
+{
+	Spill *spill = info -> spill;
+	if (info -> head -> user.name != NULL || (info -> dict != NULL && info -> dict -> size > 0)) {
+		spillList(info);
+	}
+	for (int p = 0; p < SPILL_PARTITIONS; p++) {
+		if (fclose(spill -> files[p]) != 0) forceExit("\nError: Couldn't write spill file\n");
+	}
+	summary -> spilledRuns = spill -> runs;
+	int total = spill -> runs * SPILL_PARTITIONS;
+	Tweeter *top = malloc(opts -> topCount * sizeof(Tweeter));
+	PartialReader *readers = malloc(SPILL_FAN_IN * sizeof(PartialReader));
+	char **paths = malloc(total * sizeof(char *));
+	long *offsets = malloc(total * sizeof(long));
+	if (top == NULL || readers == NULL || paths == NULL || offsets == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Spill\n");
+	}
+	int topSize = 0;
+	char *scratch = NULL;
+	if (opts -> emitPartial != NULL) {
+		for (int r = 0; r < spill -> runs; r++) {
+			for (int p = 0; p < SPILL_PARTITIONS; p++) {
+				paths[r * SPILL_PARTITIONS + p] = spill -> paths[p];
+				offsets[r * SPILL_PARTITIONS + p] = spill -> offsets[r * SPILL_PARTITIONS + p];
+			}
+		}
+		int count = reduceRuns(paths, offsets, total, &scratch);
+		for (int i = 0; i < count; i++) openPartial(&readers[i], paths[i], offsets[i], summary);
+		FILE *out = fopen(opts -> emitPartial, "wb");
+		if (out == NULL) forceExit("\nError: Couldn't open partial file\n");
+		setvbuf(out, NULL, _IOFBF, 1 << 16);
+		partialHeader(out, 0, summary -> rowsCounted);
+		mergeReaders(readers, count, out, top, &topSize, opts -> topCount, &summary -> partialNames, opts -> digest);
+		uint64_t names = summary -> partialNames;
+		fseek(out, 8, SEEK_SET);
+		fwrite(&names, sizeof(names), 1, out);
+		if (fclose(out) != 0) forceExit("\nError: Couldn't write partial file\n");
+	} else {
+		for (int p = 0; p < SPILL_PARTITIONS; p++) {
+			for (int r = 0; r < spill -> runs; r++) {
+				paths[r] = spill -> paths[p];
+				offsets[r] = spill -> offsets[r * SPILL_PARTITIONS + p];
+			}
+			int count = reduceRuns(paths, offsets, spill -> runs, &scratch);
+			for (int i = 0; i < count; i++) openPartial(&readers[i], paths[i], offsets[i], summary);
+			mergeReaders(readers, count, NULL, top, &topSize, opts -> topCount, &summary -> partialNames,
+					opts -> digest);
+		}
+	}
+	if (scratch != NULL) {
+		unlink(scratch);
+		free(scratch);
+	}
+	printTop(top, topSize);
+	for (int p = 0; p < SPILL_PARTITIONS; p++) {
+		unlink(spill -> paths[p]);
+		free(spill -> paths[p]);
+	}
+	free(readers);
+	free(paths);
+	free(offsets);
+	free(top);
+	free(spill -> offsets);
+	free(spill);
+	info -> spill = NULL;
+}
+
+/**
+ * @brief Merges spilled runs in passes until at most SPILL_FAN_IN are left
+ * 
+ * Every pass merges each group of SPILL_FAN_IN runs into one run, written
+ * back to back to a new scratch file, so no more than SPILL_FAN_IN runs
+ * are open at once. A scratch file is removed once the next pass has read
+ * it; the last one is left for the final merge.
+ * 
+ * @param paths File of every run, replaced by those of the merged runs
+ * @param offsets Where every run starts, replaced likewise
+ * @param count Number of runs
+ * @param scratch Last scratch file, NULL if none (removed and freed by the caller)
+ * @return The number of runs left
+ */
+int reduceRuns(char **paths, long *offsets, int count, char **scratch)
+{
+	PartialReader readers[SPILL_FAN_IN];
+	// spill runs record no rows, so the readers' summary stays empty
+	Summary ignored = { 0 };
+	while (count > SPILL_FAN_IN) {
+		char *path = NULL;
+		FILE *out = createSpillFile(&path);
+		int merged = 0;
+		for (int first = 0; first < count; first += SPILL_FAN_IN) {
+			int group = count - first < SPILL_FAN_IN ? count - first : SPILL_FAN_IN;
+			for (int i = 0; i < group; i++) openPartial(&readers[i], paths[first + i], offsets[first + i], &ignored);
+			long start = ftell(out);
+			unsigned long names = 0;
+			int topSize = 0;
+			partialHeader(out, 0, 0);
+			mergeReaders(readers, group, out, NULL, &topSize, 0, &names, NULL);
+			// the name count is patched in once the merge knows it
+			long end = ftell(out);
+			uint64_t written = names;
+			fseek(out, start + 8, SEEK_SET);
+			fwrite(&written, sizeof(written), 1, out);
+			fseek(out, end, SEEK_SET);
+			// runs before first have all been read, so their slots can be reused
+			paths[merged] = path;
+			offsets[merged++] = start;
+		}
+		if (fclose(out) != 0) forceExit("\nError: Couldn't write spill file\n");
+		if (*scratch != NULL) {
+			unlink(*scratch);
+			free(*scratch);
+		}
+		*scratch = path;
+		count = merged;
+	}
+	return count;
+}
+
+/**
+ * @brief Creates an empty name dictionary
+ * 
+ * @return The pointer to the new dictionary
+ */
+NameDictionary *createDictionary(void)
+{
+	NameDictionary *dict = malloc(sizeof(NameDictionary));
+	if (dict == NULL) forceExit("\nError: Couldn't allocate memory -- Dictionary\n");
+	dict -> arenaSize = 0;
+	dict -> arenaCapacity = 4096;
+	dict -> size = 0;
+	dict -> allocated = 256;
+	dict -> capacity = 512;
+	dict -> arena = malloc(dict -> arenaCapacity);
+	dict -> offsets = malloc(dict -> allocated * sizeof(uint32_t));
+	dict -> counts = malloc(dict -> allocated * sizeof(int));
+	dict -> slots = calloc(dict -> capacity, sizeof(uint32_t));
+	dict -> fingerprints = malloc(dict -> capacity * sizeof(uint32_t));
+	if (dict -> arena == NULL || dict -> offsets == NULL || dict -> counts == NULL
+			|| dict -> slots == NULL || dict -> fingerprints == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Dictionary\n");
+	}
+	return dict;
+}
+
+/**
+ * @brief Looks a name up in the dictionary
+ * 
+ * @param dict Dictionary to be searched
+ * @param name Address location of NAME to be found
+ * @return The name's id, or -1 if it has never been counted
+ */
+long dictionaryFind(NameDictionary *dict, char *name)
+{
+	uint64_t hash = hashName(name);
+	uint32_t fingerprint = hash >> 32;
+	unsigned long mask = dict -> capacity - 1;
+	for (unsigned long slot = hash & mask; dict -> slots[slot] != 0; slot = (slot + 1) & mask) {
+		uint32_t id = dict -> slots[slot] - 1;
+		if (dict -> fingerprints[slot] == fingerprint && strcmp(dict -> arena + dict -> offsets[id], name) == 0) {
+			return id;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Counts one row for a name in the dictionary
+ * 
+ * Known names only cost a hash, a probe and an increment. A new name is
+ * appended to the arena and gets the next id, and the table doubles once
+ * it is half full.
+ * 
+ * @param info Data struct which holds the dictionary and its byte estimate
+ * @param name Address location of NAME to be used
+ * @return void
+ */
+void dictionaryAdd(Link *info, char *name)
+{
+	NameDictionary *dict = info -> dict;
+	uint64_t hash = hashName(name);
+	uint32_t fingerprint = hash >> 32;
+	unsigned long mask = dict -> capacity - 1;
+	unsigned long slot = hash & mask;
+	while (dict -> slots[slot] != 0) {
+		uint32_t id = dict -> slots[slot] - 1;
+		if (dict -> fingerprints[slot] == fingerprint && strcmp(dict -> arena + dict -> offsets[id], name) == 0) {
+			++(dict -> counts[id]);
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+	unsigned long len = strlen(name) + 1;
+	if (dict -> arenaSize + len > UINT32_MAX || dict -> size >= UINT32_MAX - 1) {
+		forceExit("\nError: Too many names for the dictionary\n");
+	}
+	if (dict -> arenaSize + len > dict -> arenaCapacity) {
+		while (dict -> arenaSize + len > dict -> arenaCapacity) dict -> arenaCapacity *= 2;
+		dict -> arena = realloc(dict -> arena, dict -> arenaCapacity);
+	}
+	if (dict -> size == dict -> allocated) {
+		dict -> allocated *= 2;
+		dict -> offsets = realloc(dict -> offsets, dict -> allocated * sizeof(uint32_t));
+		dict -> counts = realloc(dict -> counts, dict -> allocated * sizeof(int));
+	}
+	if (dict -> arena == NULL || dict -> offsets == NULL || dict -> counts == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Dictionary\n");
+	}
+	memcpy(dict -> arena + dict -> arenaSize, name, len);
+	dict -> offsets[dict -> size] = dict -> arenaSize;
+	dict -> counts[dict -> size] = 1;
+	dict -> arenaSize += len;
+	dict -> slots[slot] = ++(dict -> size);
+	dict -> fingerprints[slot] = fingerprint;
+	info -> bytes += len + sizeof(uint32_t) + sizeof(int) + 4 * sizeof(uint32_t);
+	if (dict -> size * 2 > dict -> capacity) growDictionarySlots(dict);
+	if (info -> spill != NULL && info -> bytes > info -> spill -> budget) spillList(info);
+}
+
+/**
+ * @brief Doubles the dictionary's table and re-inserts every id
+ * 
+ * @param dict Dictionary to be grown
+ * @return void
+ */
+void growDictionarySlots(NameDictionary *dict)
+{
+	free(dict -> slots);
+	free(dict -> fingerprints);
+	dict -> capacity *= 2;
+	dict -> slots = calloc(dict -> capacity, sizeof(uint32_t));
+	dict -> fingerprints = malloc(dict -> capacity * sizeof(uint32_t));
+	if (dict -> slots == NULL || dict -> fingerprints == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Dictionary\n");
+	}
+	unsigned long mask = dict -> capacity - 1;
+	for (unsigned long id = 0; id < dict -> size; id++) {
+		uint64_t hash = hashName(dict -> arena + dict -> offsets[id]);
+		unsigned long slot = hash & mask;
+		while (dict -> slots[slot] != 0) slot = (slot + 1) & mask;
+		dict -> slots[slot] = id + 1;
+		dict -> fingerprints[slot] = hash >> 32;
+	}
+}
+
+/**
+ * @brief Prints the top names of the dictionary
+ * 
+ * Ties keep first-seen order since ids are scanned in order.
+ * 
+ * @param dict Dictionary to be ranked
+ * @param count The num names you want printed
+ * @return void
+ */
+void printDictionary(NameDictionary *dict, int count)
+{
+	Tweeter *top = malloc(count * sizeof(Tweeter));
+	if (top == NULL) forceExit("\nError: Couldn't allocate memory -- Dictionary\n");
+	int topSize = 0;
+	for (unsigned long id = 0; id < dict -> size; id++) {
+		if (topSize == count && dict -> counts[id] <= top[count - 1].count) continue;
+		updateTop(top, &topSize, count, dict -> arena + dict -> offsets[id], dict -> counts[id]);
+	}
+	for (int i = 0; i < topSize; i++) {
+		printf("%s: %d\n", top[i].name, top[i].count);
+	}
+	free(top);
+}
+
+/**
+ * @brief Frees all the memory held by the dictionary
+ * 
+ * @param dict Dictionary to be freed
+ * @return void
+ */
+void freeDictionary(NameDictionary *dict)
+{
+	free(dict -> arena);
+	free(dict -> offsets);
+	free(dict -> counts);
+	free(dict -> slots);
+	free(dict -> fingerprints);
+	free(dict);
+}
+
+/**
+ * @brief Starts the --pipeline reader thread on a file
+ * 
+ * The file must be unbuffered (or not read from yet) so its descriptor
+ * is positioned right after whatever the FILE has already returned.
+ * 
+ * @param file File whose remaining bytes are read by the thread
+ * @return The pointer to the new reader
+ */
+BlockReader *createBlockReader(FILE *file)
+{
+	BlockReader *reader = malloc(sizeof(BlockReader));
+	if (reader == NULL) forceExit("\nError: Couldn't allocate memory -- Block Reader\n");
+	reader -> fd = dup(fileno(file));
+	if (reader -> fd == -1) forceExit("\nError: Couldn't start reader thread\n");
+	for (int i = 0; i < BLOCK_COUNT; i++) {
+		void *data = NULL;
+		if (posix_memalign(&data, 4096, BLOCK_SIZE) != 0) {
+			forceExit("\nError: Couldn't allocate memory -- Block Reader\n");
+		}
+		reader -> blocks[i].data = data;
+		reader -> blocks[i].length = 0;
+	}
+	reader -> readIndex = reader -> writeIndex = reader -> filled = 0;
+	reader -> done = reader -> failed = 0;
+	reader -> current = NULL;
+	reader -> position = 0;
+	pthread_mutex_init(&reader -> lock, NULL);
+	pthread_cond_init(&reader -> notEmpty, NULL);
+	pthread_cond_init(&reader -> notFull, NULL);
+	if (pthread_create(&reader -> thread, NULL, readBlocks, reader) != 0) {
+		forceExit("\nError: Couldn't start reader thread\n");
+	}
+	return reader;
+}
+
+/**
+ * @brief Body of the --pipeline reader thread
+ * 
+ * readBlocks fills free blocks with read() until end of file. The bytes
+ * after the last newline of a block are held back and start the next
+ * block, so every block handed over ends on a complete line.
+ * 
+ * @param arg The BlockReader
+ * @return NULL
+ */
+void *readBlocks(void *arg)
+{
+	BlockReader *reader = arg;
+	char *carry = malloc(BLOCK_SIZE);
+	size_t carried = 0;
+	int atEnd = 0;
+	if (carry == NULL) reader -> failed = 1;
+	while (!atEnd && carry != NULL) {
+		pthread_mutex_lock(&reader -> lock);
+		while (reader -> filled == BLOCK_COUNT) pthread_cond_wait(&reader -> notFull, &reader -> lock);
+		pthread_mutex_unlock(&reader -> lock);
+		Block *block = &reader -> blocks[reader -> writeIndex];
+		memcpy(block -> data, carry, carried);
+		size_t total = carried;
+		while (total < BLOCK_SIZE) {
+			ssize_t got = read(reader -> fd, block -> data + total, BLOCK_SIZE - total);
+			if (got < 0) {
+				reader -> failed = 1;
+				got = 0;
+			}
+			if (got == 0) {
+				atEnd = 1;
+				break;
+			}
+			total += got;
+		}
+		block -> length = total;
+		carried = 0;
+		if (!atEnd) {
+			char *last = block -> data + total;
+			while (last > block -> data && last[-1] != '\n') last--;
+			if (last > block -> data) {
+				// hold back the partial line for the next block
+				carried = block -> data + total - last;
+				memcpy(carry, last, carried);
+				block -> length = total - carried;
+			}
+		}
+		pthread_mutex_lock(&reader -> lock);
+		if (block -> length > 0) {
+			reader -> writeIndex = (reader -> writeIndex + 1) % BLOCK_COUNT;
+			++(reader -> filled);
+		}
+		if (atEnd) reader -> done = 1;
+		pthread_cond_signal(&reader -> notEmpty);
+		pthread_mutex_unlock(&reader -> lock);
+	}
+	pthread_mutex_lock(&reader -> lock);
+	reader -> done = 1;
+	pthread_cond_signal(&reader -> notEmpty);
+	pthread_mutex_unlock(&reader -> lock);
+	free(carry);
+	return NULL;
+}
+
+/**
+ * @brief Copies the next line from the reader's blocks into buff
+ * 
+ * Behaves like fgets: at most size - 1 chars are copied, the newline is
+ * kept, and a longer line is returned in several pieces. Finished blocks
+ * are handed back to the reader thread.
+ * 
+ * @param reader The BlockReader
+ * @param buff Buffer the line is copied into
+ * @param size Size of buff
+ * @return buff, or NULL at end of file
+ */
+char *readBlockLine(BlockReader *reader, char *buff, int size)
+{
+	if (reader -> current == NULL || reader -> position == reader -> current -> length) {
+		pthread_mutex_lock(&reader -> lock);
+		if (reader -> current != NULL) {
+			reader -> readIndex = (reader -> readIndex + 1) % BLOCK_COUNT;
+			--(reader -> filled);
+			reader -> current = NULL;
+			pthread_cond_signal(&reader -> notFull);
+		}
+		while (reader -> filled == 0 && !reader -> done) {
+			pthread_cond_wait(&reader -> notEmpty, &reader -> lock);
+		}
+		if (reader -> filled > 0) reader -> current = &reader -> blocks[reader -> readIndex];
+		pthread_mutex_unlock(&reader -> lock);
+		reader -> position = 0;
+		if (reader -> current == NULL) {
+			if (reader -> failed) forceExit("\nError: Couldn't read CSV file\n");
+			return NULL;
+		}
+	}
+	char *start = reader -> current -> data + reader -> position;
+	size_t left = reader -> current -> length - reader -> position;
+	size_t limit = left < (size_t) size - 1 ? left : (size_t) size - 1;
+	char *newLine = memchr(start, '\n', limit);
+	size_t length = newLine != NULL ? (size_t) (newLine - start) + 1 : limit;
+	memcpy(buff, start, length);
+	buff[length] = '\0';
+	reader -> position += length;
+	return buff;
+}
+
+/**
+ * @brief Waits for the reader thread and frees its blocks
+ * 
+ * Only called once readBlockLine has returned NULL, so the thread has
+ * already finished.
+ * 
+ * @param reader The BlockReader
+ * @return void
+ */
+void freeBlockReader(BlockReader *reader)
+{
+	pthread_join(reader -> thread, NULL);
+	for (int i = 0; i < BLOCK_COUNT; i++) free(reader -> blocks[i].data);
+	pthread_mutex_destroy(&reader -> lock);
+	pthread_cond_destroy(&reader -> notEmpty);
+	pthread_cond_destroy(&reader -> notFull);
+	close(reader -> fd);
+	free(reader);
+}
+
+/**
+ * @brief Works out how many worker threads a parallel stage should use
+ * 
+ * @param opts Options holding --threads
+ * @return --threads if given, else the number of online CPUs (at most 64)
+ */
+int threadCount(Options *opts)
+{
+	if (opts -> threads > 0) return opts -> threads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) return 1;
+	return cpus > 64 ? 64 : cpus;
+}
+
+/**
+ * @brief Identifies a compressed format from the first bytes of a file
+ * 
+ * @param magic First bytes of the file
+ * @param length Number of bytes in magic
+ * @return INPUT_GZIP, INPUT_ZSTD or INPUT_PLAIN
+ */
+int detectFormat(unsigned char *magic, int length)
+{
+	if (length >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return INPUT_GZIP;
+	if (length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+		return INPUT_ZSTD;
+	}
+	return INPUT_PLAIN;
+}
+
+/**
+ * @brief Opens the CSV, decompressing it in the background if needed
+ * 
+ * openInput checks the magic bytes of the file. A plain regular file is
+ * returned as is. Compressed files, and plain streams whose first bytes
+ * have already been consumed by the check, are handed to a decoder
+ * thread and the read end of its pipe is returned instead.
+ * 
+ * @param path Location of the CSV (possibly gzip or zstd compressed)
+ * @param opts Options holding --threads
+ * @return The file the CSV text can be read from
+ */
+FILE *openInput(char *path, Options *opts)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) forceExit("\nError: No file\n");
+	struct stat info;
+	if (fstat(fd, &info) != 0) forceExit("\nError: No file\n");
+	unsigned char magic[4];
+	int length = 0;
+	while (length < 4) {
+		ssize_t got = read(fd, magic + length, 4 - length);
+		if (got <= 0) break;
+		length += got;
+	}
+	int format = detectFormat(magic, length);
+	int regular = S_ISREG(info.st_mode);
+	if (regular) lseek(fd, 0, SEEK_SET);
+	if (format == INPUT_PLAIN && (regular || length == 0)) {
+		FILE *file = fdopen(fd, "r");
+		if (file == NULL) forceExit("\nError: No file\n");
+		return file;
+	}
+#ifndef HAVE_ZLIB
+	if (format == INPUT_GZIP) forceExit("\nError: gzip input needs a build with ZLIB=1\n");
+#endif
+#ifndef HAVE_ZSTD
+	if (format == INPUT_ZSTD) forceExit("\nError: zstd input needs a build with ZSTD=1\n");
+#endif
+	int ends[2];
+	signal(SIGPIPE, SIG_IGN);
+	Decoder *decoder = malloc(sizeof(Decoder));
+	if (decoder == NULL || pipe(ends) != 0) forceExit("\nError: Couldn't start decoder thread\n");
+	decoder -> in = fd;
+	decoder -> out = ends[1];
+	decoder -> format = format;
+	decoder -> prefixLength = regular ? 0 : length;
+	memcpy(decoder -> prefix, magic, length);
+	decoder -> map = NULL;
+	decoder -> size = info.st_size;
+	decoder -> threads = threadCount(opts);
+	if (regular && format != INPUT_PLAIN && info.st_size > 0) {
+		void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) decoder -> map = map;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, decodeInput, decoder) != 0) {
+		forceExit("\nError: Couldn't start decoder thread\n");
+	}
+	pthread_detach(thread);
+	FILE *file = fdopen(ends[0], "r");
+	if (file == NULL) forceExit("\nError: No file\n");
+	return file;
+}
+
+/**
+ * @brief Body of the decoder thread
+ * 
+ * Files which split into several independent chunks are decoded in
+ * parallel; everything else is decoded as a single stream. Closing the
+ * pipe afterwards is what the reader sees as end of file.
+ * 
+ * @param arg The Decoder
+ * @return NULL
+ */
+void *decodeInput(void *arg)
+{
+	Decoder *decoder = arg;
+	Chunk *chunks = NULL;
+	int count = 0;
+	if (decoder -> map != NULL) count = splitChunks(decoder, &chunks);
+	if (count > 1 && decoder -> threads > 1) {
+		decodeParallel(decoder, chunks, count);
+	} else {
+		decodeStream(decoder);
+	}
+	free(chunks);
+	if (decoder -> map != NULL) munmap(decoder -> map, decoder -> size);
+	close(decoder -> in);
+	close(decoder -> out);
+	free(decoder);
+	return NULL;
+}
+
+/**
+ * @brief Writes a whole buffer to a descriptor
+ * 
+ * @param fd Descriptor to be written to
+ * @param data Bytes to be written
+ * @param length Number of bytes
+ * @return void
+ */
+void writeAll(int fd, const void *data, size_t length)
+{
+	const char *bytes = data;
+	while (length > 0) {
+		ssize_t wrote = write(fd, bytes, length);
+		// the reader only closes early when it is exiting with its own error
+		if (wrote < 0 && errno == EPIPE) pthread_exit(NULL);
+		if (wrote <= 0) forceExit("\nError: Couldn't pass on decompressed data\n");
+		bytes += wrote;
+		length -= wrote;
+	}
+}
+
+/**
+ * @brief Splits a mmap()ed compressed file into independent chunks
+ * 
+ * zstd frames carry enough information to find the next frame without
+ * decompressing. gzip members only do when every member has a BGZF 'BC'
+ * extra field holding its size; otherwise the file can't be split.
+ * 
+ * @param decoder Decoder holding the mapped file
+ * @param chunks Set to the array of chunks (to be freed by the caller)
+ * @return Number of chunks, or 0 if the file can't be split
+ */
+int splitChunks(Decoder *decoder, Chunk **chunks)
+{
+	int count = 0, allocated = 64;
+	size_t offset = 0;
+	Chunk *list = malloc(allocated * sizeof(Chunk));
+	if (list == NULL) return 0;
+	while (offset < decoder -> size) {
+		const unsigned char *data = decoder -> map + offset;
+		size_t left = decoder -> size - offset;
+		size_t size = 0;
+		if (decoder -> format == INPUT_GZIP) {
+			// ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2) then SI1 SI2 SLEN(2) BSIZE(2)
+			if (left < 18 || data[0] != 0x1f || data[1] != 0x8b || !(data[3] & 4)
+					|| data[12] != 'B' || data[13] != 'C' || data[14] != 2 || data[15] != 0) {
+				count = 0;
+				break;
+			}
+			size = (data[16] | data[17] << 8) + 1;
+		} else {
+#ifdef HAVE_ZSTD
+			size = ZSTD_findFrameCompressedSize(data, left);
+			if (ZSTD_isError(size)) size = 0;
+#endif
+		}
+		if (size == 0 || size > left) {
+			count = 0;
+			break;
+		}
+		if (count == allocated) {
+			allocated *= 2;
+			Chunk *grown = realloc(list, allocated * sizeof(Chunk));
+			if (grown == NULL) {
+				count = 0;
+				break;
+			}
+			list = grown;
+		}
+		list[count].data = data;
+		list[count].size = size;
+		list[count].output = NULL;
+		list[count].length = list[count].capacity = 0;
+		list[count].done = 0;
+		count++;
+		offset += size;
+	}
+	*chunks = list;
+	return count;
+}
+
+/**
+ * @brief Makes room for at least extra more decoded bytes in a chunk
+ * 
+ * @param chunk Chunk whose output buffer is grown
+ * @param extra Number of bytes needed past length
+ * @return void
+ */
+void chunkReserve(Chunk *chunk, size_t extra)
+{
+	if (chunk -> length + extra <= chunk -> capacity) return;
+	size_t capacity = chunk -> capacity > 0 ? chunk -> capacity : 1 << 16;
+	while (capacity < chunk -> length + extra) capacity *= 2;
+	chunk -> output = realloc(chunk -> output, capacity);
+	if (chunk -> output == NULL) forceExit("\nError: Couldn't allocate memory -- Decoder\n");
+	chunk -> capacity = capacity;
+}
+
+/**
+ * @brief Decodes one chunk into its output buffer
+ * 
+ * @param format INPUT_GZIP or INPUT_ZSTD
+ * @param chunk Chunk to be decoded
+ * @return void
+ */
+void decodeChunk(int format, Chunk *chunk)
+{
+	if (format == INPUT_GZIP) {
+#ifdef HAVE_ZLIB
+		// the member trailer holds the decoded size (mod 2^32), but a corrupt one mustn't size the buffer
+		const unsigned char *end = chunk -> data + chunk -> size;
+		size_t decoded = end[-4] | end[-3] << 8 | end[-2] << 16 | (size_t) end[-1] << 24;
+		chunkReserve(chunk, (decoded < GZIP_RESERVE_MAX ? decoded : GZIP_RESERVE_MAX) + 1);
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if (inflateInit2(&stream, 15 + 16) != Z_OK) forceExit("\nError: Couldn't start gzip decoder\n");
+		stream.next_in = (unsigned char *) chunk -> data;
+		stream.avail_in = chunk -> size;
+		int status = Z_OK;
+		while (status != Z_STREAM_END) {
+			chunkReserve(chunk, 1 << 16);
+			stream.next_out = chunk -> output + chunk -> length;
+			stream.avail_out = chunk -> capacity - chunk -> length;
+			status = inflate(&stream, Z_NO_FLUSH);
+			chunk -> length = chunk -> capacity - stream.avail_out;
+			if (status != Z_OK && status != Z_STREAM_END) forceExit("\nError: Corrupt gzip input\n");
+		}
+		inflateEnd(&stream);
+#endif
+	} else {
+#ifdef HAVE_ZSTD
+		ZSTD_DStream *stream = ZSTD_createDStream();
+		if (stream == NULL) forceExit("\nError: Couldn't start zstd decoder\n");
+		ZSTD_initDStream(stream);
+		ZSTD_inBuffer in = { chunk -> data, chunk -> size, 0 };
+		size_t status = 1;
+		while (status != 0) {
+			chunkReserve(chunk, ZSTD_DStreamOutSize());
+			ZSTD_outBuffer out = { chunk -> output, chunk -> capacity, chunk -> length };
+			status = ZSTD_decompressStream(stream, &out, &in);
+			if (ZSTD_isError(status)) forceExit("\nError: Corrupt zstd input\n");
+			chunk -> length = out.pos;
+			if (status != 0 && in.pos == in.size && out.pos < out.size) {
+				forceExit("\nError: Truncated zstd input\n");
+			}
+		}
+		ZSTD_freeDStream(stream);
+#endif
+	}
+}
+
+/**
+ * @brief Body of a parallel decode worker
+ * 
+ * @param arg The shared DecodeJob
+ * @return NULL
+ */
+void *decodeWorker(void *arg)
+{
+	DecodeJob *job = arg;
+	while (1) {
+		pthread_mutex_lock(&job -> lock);
+		while (job -> taken < job -> count && job -> taken >= job -> written + job -> window) {
+			pthread_cond_wait(&job -> changed, &job -> lock);
+		}
+		if (job -> taken >= job -> count) {
+			pthread_mutex_unlock(&job -> lock);
+			return NULL;
+		}
+		Chunk *chunk = &job -> chunks[job -> taken++];
+		pthread_mutex_unlock(&job -> lock);
+		decodeChunk(job -> decoder -> format, chunk);
+		pthread_mutex_lock(&job -> lock);
+		chunk -> done = 1;
+		pthread_cond_broadcast(&job -> changed);
+		pthread_mutex_unlock(&job -> lock);
+	}
+}
+
+/**
+ * @brief Decodes chunks on several threads and writes them out in order
+ * 
+ * @param decoder Decoder holding the output pipe and thread count
+ * @param chunks Independent chunks of the input, in file order
+ * @param count Number of chunks
+ * @return void
+ */
+void decodeParallel(Decoder *decoder, Chunk *chunks, int count)
+{
+	DecodeJob job;
+	job.decoder = decoder;
+	job.chunks = chunks;
+	job.count = count;
+	job.taken = job.written = 0;
+	job.window = decoder -> threads * 4;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.changed, NULL);
+	int workers = decoder -> threads < count ? decoder -> threads : count;
+	pthread_t *threads = malloc(workers * sizeof(pthread_t));
+	if (threads == NULL) forceExit("\nError: Couldn't allocate memory -- Decoder\n");
+	for (int i = 0; i < workers; i++) {
+		if (pthread_create(&threads[i], NULL, decodeWorker, &job) != 0) {
+			forceExit("\nError: Couldn't start decoder thread\n");
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		pthread_mutex_lock(&job.lock);
+		while (!chunks[i].done) pthread_cond_wait(&job.changed, &job.lock);
+		pthread_mutex_unlock(&job.lock);
+		writeAll(decoder -> out, chunks[i].output, chunks[i].length);
+		free(chunks[i].output);
+		pthread_mutex_lock(&job.lock);
+		job.written++;
+		pthread_cond_broadcast(&job.changed);
+		pthread_mutex_unlock(&job.lock);
+	}
+	for (int i = 0; i < workers; i++) pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.changed);
+}
+
+/**
+ * @brief Decodes the whole input as one stream
+ * 
+ * Used for streams, single-chunk files and gzip files without member
+ * sizes. Concatenated gzip members and zstd frames are decoded one after
+ * another. Plain streams are copied through unchanged.
+ * 
+ * @param decoder Decoder holding the input, prefix and output pipe
+ * @return void
+ */
+void decodeStream(Decoder *decoder)
+{
+	size_t bufferSize = 1 << 18;
+	unsigned char *input = malloc(bufferSize);
+	unsigned char *output = malloc(bufferSize);
+	if (input == NULL || output == NULL) forceExit("\nError: Couldn't allocate memory -- Decoder\n");
+	size_t available = decoder -> prefixLength;
+	memcpy(input, decoder -> prefix, available);
+#ifdef HAVE_ZLIB
+	z_stream gzip;
+	memset(&gzip, 0, sizeof(gzip));
+	if (decoder -> format == INPUT_GZIP && inflateInit2(&gzip, 15 + 16) != Z_OK) {
+		forceExit("\nError: Couldn't start gzip decoder\n");
+	}
+	int memberEnded = 0;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zstd = NULL;
+	size_t frameStatus = 0;
+	if (decoder -> format == INPUT_ZSTD) {
+		zstd = ZSTD_createDStream();
+		if (zstd == NULL) forceExit("\nError: Couldn't start zstd decoder\n");
+		ZSTD_initDStream(zstd);
+	}
+#endif
+	while (1) {
+		ssize_t got = read(decoder -> in, input + available, bufferSize - available);
+		if (got < 0) forceExit("\nError: Couldn't read CSV file\n");
+		available += got;
+		if (available == 0) break;
+		if (decoder -> format == INPUT_PLAIN) {
+			writeAll(decoder -> out, input, available);
+			available = 0;
+			continue;
+		}
+#ifdef HAVE_ZLIB
+		if (decoder -> format == INPUT_GZIP) {
+			gzip.next_in = input;
+			gzip.avail_in = available;
+			while (gzip.avail_in > 0) {
+				if (memberEnded) {
+					// another member follows -- anything else is trailing garbage
+					if (gzip.next_in[0] != 0x1f) {
+						gzip.avail_in = 0;
+						break;
+					}
+					inflateReset(&gzip);
+					memberEnded = 0;
+				}
+				gzip.next_out = output;
+				gzip.avail_out = bufferSize;
+				int status = inflate(&gzip, Z_NO_FLUSH);
+				if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+					forceExit("\nError: Corrupt gzip input\n");
+				}
+				writeAll(decoder -> out, output, bufferSize - gzip.avail_out);
+				if (status == Z_STREAM_END) memberEnded = 1;
+				if (status == Z_BUF_ERROR) break;
+			}
+		}
+#endif
+#ifdef HAVE_ZSTD
+		if (decoder -> format == INPUT_ZSTD) {
+			ZSTD_inBuffer in = { input, available, 0 };
+			while (in.pos < in.size) {
+				ZSTD_outBuffer out = { output, bufferSize, 0 };
+				frameStatus = ZSTD_decompressStream(zstd, &out, &in);
+				if (ZSTD_isError(frameStatus)) forceExit("\nError: Corrupt zstd input\n");
+				writeAll(decoder -> out, output, out.pos);
+			}
+		}
+#endif
+		available = 0;
+		if (got == 0) break;
+	}
+#ifdef HAVE_ZLIB
+	if (decoder -> format == INPUT_GZIP) {
+		if (!memberEnded) forceExit("\nError: Truncated gzip input\n");
+		inflateEnd(&gzip);
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (zstd != NULL) {
+		if (frameStatus != 0) forceExit("\nError: Truncated zstd input\n");
+		ZSTD_freeDStream(zstd);
+	}
+#endif
+	free(input);
+	free(output);
+}
+
+/**
+ * @brief Runs the --serve daemon until a client sends "shutdown"
+ * 
+ * Every positional file is loaded once into a NameDictionary. The daemon
+ * then waits on the socket, picking up rows appended to the files every
+ * time it wakes (on a query, or at least once a second), and answers one
+ * query per line:
+ * 
+ *   top [count]   The top count tweeters (default: --top), as in the normal output
+ *   count name    The name's count (0 if never seen)
+ *   rank name     The name's position in the full ranking
+ *   stats         Rows read, counted and rejected and the number of distinct names
+ *   shutdown      Stops the daemon
+ * 
+ * Every reply ends with an empty line.
+ * 
+ * @param opts Options holding the files and socket path
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void serve(Options *opts, Summary *summary)
+{
+	Server server;
+	server.sourceCount = opts -> fileCount;
+	server.sources = malloc(opts -> fileCount * sizeof(Source));
+	server.info = malloc(sizeof(Link));
+	if (server.sources == NULL || server.info == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	server.info -> head = server.info -> last = createNode(1, server.info);
+	server.info -> bytes = 0;
+	server.info -> spill = NULL;
+	server.info -> dict = createDictionary();
+	server.info -> shared = NULL;
+	server.opts = opts;
+	server.summary = summary;
+	server.ranking = server.ranks = NULL;
+	server.stale = 1;
+	server.running = 1;
+	server.rejects = createQuarantine();
+	if (opts -> onlyNames != NULL) opts -> watchlist = loadWatchlist(opts -> onlyNames, opts -> fold);
+	for (int i = 0; i < opts -> fileCount; i++) {
+		openSource(&server.sources[i], opts -> files[i], opts);
+		ingestSource(&server, &server.sources[i], 1);
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(opts -> serve) >= sizeof(address.sun_path)) forceExit("\nError: --serve socket path too long\n");
+	strcpy(address.sun_path, opts -> serve);
+	// only a socket left behind by an earlier daemon is replaced
+	struct stat existing;
+	if (stat(opts -> serve, &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(opts -> serve);
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0
+			|| listen(listener, SERVE_CLIENTS) != 0) {
+		forceExit("\nError: Couldn't listen on --serve socket\n");
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	struct pollfd fds[SERVE_CLIENTS + 1];
+	char lines[SERVE_CLIENTS + 1][MAX_CHAR];
+	int lengths[SERVE_CLIENTS + 1];
+	int count = 1;
+	fds[0].fd = listener;
+	fds[0].events = POLLIN;
+	while (server.running) {
+		if (poll(fds, count, 1000) < 0 && errno != EINTR) forceExit("\nError: poll failed\n");
+		for (int i = 0; i < server.sourceCount; i++) ingestSource(&server, &server.sources[i], 0);
+		if (fds[0].revents & POLLIN) {
+			int client = accept(listener, NULL, NULL);
+			if (client >= 0 && count == SERVE_CLIENTS + 1) {
+				close(client);
+			} else if (client >= 0) {
+				fds[count].fd = client;
+				fds[count].events = POLLIN;
+				fds[count].revents = 0;
+				lengths[count++] = 0;
+			}
+		}
+		for (int i = 1; i < count && server.running; i++) {
+			if (!fds[i].revents) continue;
+			ssize_t got = read(fds[i].fd, lines[i] + lengths[i], MAX_CHAR - lengths[i]);
+			int open = got > 0;
+			if (open) lengths[i] += got;
+			char *newline;
+			while (open && server.running && (newline = memchr(lines[i], '\n', lengths[i])) != NULL) {
+				*newline = '\0';
+				char *text = NULL;
+				size_t length = 0;
+				FILE *reply = open_memstream(&text, &length);
+				if (reply == NULL) forceExit("\nError: Couldn't allocate memory -- Reply\n");
+				answerQuery(&server, lines[i], reply);
+				fclose(reply);
+				open = sendReply(fds[i].fd, text, length);
+				free(text);
+				lengths[i] -= newline + 1 - lines[i];
+				memmove(lines[i], newline + 1, lengths[i]);
+			}
+			if (open && lengths[i] == MAX_CHAR) {
+				sendReply(fds[i].fd, "Error: Query too long\n\n", 23);
+				open = 0;
+			}
+			if (!open) {
+				close(fds[i].fd);
+				fds[i] = fds[--count];
+				memcpy(lines[i], lines[count], lengths[count]);
+				lengths[i] = lengths[count];
+				i--;
+			}
+		}
+	}
+	for (int i = 1; i < count; i++) close(fds[i].fd);
+	close(listener);
+	unlink(opts -> serve);
+	for (int i = 0; i < server.sourceCount; i++) fclose(server.sources[i].file);
+	free(server.sources);
+	free(server.ranking);
+	free(server.ranks);
+	closeQuarantine(server.rejects, NULL, summary);
+	free(server.rejects);
+	if (opts -> watchlist != NULL) freeWatchlist(opts -> watchlist);
+	opts -> watchlist = NULL;
+	freeDictionary(server.info -> dict);
+	freeLinkedMemory(server.info -> head, server.info);
+}
+
+/**
+ * @brief Opens a CSV for --serve and reads its header
+ * 
+ * @param source Source to be filled in
+ * @param path Location of the CSV
+ * @param opts Options used to resolve the header
+ * @return void
+ */
+void openSource(Source *source, char *path, Options *opts)
+{
+	source -> path = path;
+	source -> file = openInput(path, opts);
+	struct stat info;
+	if (fstat(fileno(source -> file), &info) != 0 || !S_ISREG(info.st_mode)) {
+		forceExit("\nError: --serve needs plain (uncompressed) CSV files\n");
+	}
+	source -> quoted = -1;
+	source -> comma = 0;
+	source -> oneCol = -1;
+	source -> skipping = 0;
+	source -> namePos = getNameIndex(source -> file, &source -> quoted, &source -> comma, &source -> oneCol, opts);
+	source -> offset = ftell(source -> file);
+}
+
+/**
+ * @brief Counts the complete rows appended to a source since the last call
+ * 
+ * New bytes are read up to the last newline (a row still being written
+ * is left for the next call) and run through processData in batches kept
+ * well under MAX_LINE rows, so the daemon isn't bound by the line limit
+ * of a single run. The initial load reads the file whole, so a last row
+ * without a newline is counted just like in a normal run, and is as
+ * strict. Appended rows that are invalid are skipped and counted instead
+ * (a row too long for the buffer is dropped up to its newline).
+ * 
+ * @param server Server holding the count table
+ * @param source Source to be read
+ * @param whole 1 to also count a final row without a newline
+ * @return The number of rows counted
+ */
+long ingestSource(Server *server, Source *source, int whole)
+{
+	struct stat info;
+	long counted = server -> summary -> rowsCounted;
+	char *buffer = NULL;
+	Options batch = *(server -> opts);
+	batch.pipeline = 0;
+	if (!whole) batch.quarantine = server -> rejects;
+	while (fstat(fileno(source -> file), &info) == 0 && info.st_size > source -> offset) {
+		if (buffer == NULL && (buffer = malloc(BLOCK_SIZE)) == NULL) {
+			forceExit("\nError: Couldn't allocate memory -- Ingest\n");
+		}
+		long want = info.st_size - source -> offset;
+		if (want > BLOCK_SIZE) want = BLOCK_SIZE;
+		ssize_t got = pread(fileno(source -> file), buffer, want, source -> offset);
+		if (got <= 0) break;
+		if (source -> skipping) {
+			char *newline = memchr(buffer, '\n', got);
+			source -> offset += newline != NULL ? newline - buffer + 1 : got;
+			source -> skipping = newline == NULL;
+			continue;
+		}
+		long cut = 0;
+		int rows = 0;
+		for (long i = 0; i < got && rows < MAX_LINE / 2; i++) {
+			if (buffer[i] == '\n') {
+				cut = i + 1;
+				rows++;
+			}
+		}
+		if (whole && rows < MAX_LINE / 2 && source -> offset + got == info.st_size) cut = got;
+		if (cut == 0 && got == BLOCK_SIZE && !whole) {
+			server -> rejects -> rows++;
+			source -> skipping = 1;
+			continue;
+		} else if (cut == 0) {
+			if (got == BLOCK_SIZE) forceExit("\nError: Invalid input format -- too many characters in the line\n");
+			break;
+		}
+		FILE *rowsFile = fmemopen(buffer, cut, "r");
+		if (rowsFile == NULL) forceExit("\nError: Couldn't allocate memory -- Ingest\n");
+		processData(rowsFile, source -> namePos, server -> info, source -> quoted, source -> comma,
+				source -> oneCol, &batch, server -> summary);
+		fclose(rowsFile);
+		source -> offset += cut;
+	}
+	free(buffer);
+	counted = server -> summary -> rowsCounted - counted;
+	if (counted > 0) server -> stale = 1;
+	return counted;
+}
+
+/**
+ * @brief Rebuilds the ranking of every name after new rows arrived
+ * 
+ * Ids are sorted on a single 64-bit key, count (descending) then id, so
+ * ties keep first-seen order just like printDictionary.
+ * 
+ * @param server Server whose ranking is rebuilt
+ * @return void
+ */
+void rankNames(Server *server)
+{
+	NameDictionary *dict = server -> info -> dict;
+	unsigned long size = dict -> size > 0 ? dict -> size : 1;
+	uint64_t *keys = malloc(size * sizeof(uint64_t));
+	free(server -> ranking);
+	free(server -> ranks);
+	server -> ranking = malloc(size * sizeof(uint32_t));
+	server -> ranks = malloc(size * sizeof(uint32_t));
+	if (keys == NULL || server -> ranking == NULL || server -> ranks == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Ranking\n");
+	}
+	for (unsigned long id = 0; id < dict -> size; id++) {
+		keys[id] = (uint64_t) (UINT32_MAX - (uint32_t) dict -> counts[id]) << 32 | id;
+	}
+	qsort(keys, dict -> size, sizeof(uint64_t), compareKeys);
+	for (unsigned long i = 0; i < dict -> size; i++) {
+		server -> ranking[i] = (uint32_t) keys[i];
+		server -> ranks[(uint32_t) keys[i]] = i;
+	}
+	free(keys);
+	server -> stale = 0;
+}
+
+/**
+ * @brief qsort comparator ordering 64-bit keys ascending
+ * 
+ * @param left Address of the first key
+ * @param right Address of the second key
+ * @return Negative, zero or positive as left is below, equal to or above right
+ */
+int compareKeys(const void *left, const void *right)
+{
+	uint64_t a = *(const uint64_t *) left, b = *(const uint64_t *) right;
+	return (a > b) - (a < b);
+}
+
+/**
+ * @brief Answers one --serve query
+ * 
+ * @param server Server holding the count table
+ * @param query The query line (without its newline)
+ * @param reply Stream the reply is written to
+ * @return void
+ */
+void answerQuery(Server *server, char *query, FILE *reply)
+{
+	NameDictionary *dict = server -> info -> dict;
+	query[strcspn(query, "\r")] = '\0';
+	char *argument = strchr(query, ' ');
+	if (argument != NULL) *argument++ = '\0';
+	if ((strcmp(query, "top") == 0 || strcmp(query, "rank") == 0) && server -> stale) rankNames(server);
+	if (strcmp(query, "top") == 0) {
+		char *end = NULL;
+		long count = argument == NULL ? server -> opts -> topCount : strtol(argument, &end, 10);
+		if (argument != NULL && (end == argument || *end != '\0' || count <= 0)) {
+			fprintf(reply, "Error: Bad count\n");
+		} else {
+			for (unsigned long i = 0; i < dict -> size && i < (unsigned long) count; i++) {
+				uint32_t id = server -> ranking[i];
+				fprintf(reply, "%s: %d\n", dict -> arena + dict -> offsets[id], dict -> counts[id]);
+			}
+		}
+	} else if ((strcmp(query, "count") == 0 || strcmp(query, "rank") == 0) && argument != NULL) {
+		long id = dictionaryFind(dict, argument);
+		if (strcmp(query, "count") == 0) {
+			fprintf(reply, "%s: %d\n", argument, id >= 0 ? dict -> counts[id] : 0);
+		} else if (id >= 0) {
+			fprintf(reply, "%s: %u of %lu\n", argument, server -> ranks[id] + 1, dict -> size);
+		} else {
+			fprintf(reply, "%s: not ranked\n", argument);
+		}
+	} else if (strcmp(query, "stats") == 0) {
+		fprintf(reply, "Rows read: %ld\nRows counted: %ld\nRows rejected: %ld\nDistinct names: %lu\n",
+				server -> summary -> rowsRead, server -> summary -> rowsCounted, server -> rejects -> rows, dict -> size);
+	} else if (strcmp(query, "shutdown") == 0) {
+		server -> running = 0;
+	} else {
+		fprintf(reply, "Error: Unknown query -- use top [count], count name, rank name, stats or shutdown\n");
+	}
+	fprintf(reply, "\n");
+}
+
+/**
+ * @brief Sends a whole reply to a --serve client
+ * 
+ * @param fd The client's socket
+ * @param text Reply to be sent
+ * @param length Number of bytes in text
+ * @return 1 if it was sent, 0 if the client has gone away
+ */
+int sendReply(int fd, char *text, size_t length)
+{
+	while (length > 0) {
+		ssize_t sent = send(fd, text, length, MSG_NOSIGNAL);
+		if (sent <= 0) return 0;
+		text += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+/**
+ * @brief Creates an empty shared table
+ * 
+ * @param expected Rough number of names expected, used to size the buckets
+ * @return The pointer to the new table
+ */
+SharedTable *createSharedTable(unsigned long expected)
+{
+	SharedTable *table = malloc(sizeof(SharedTable));
+	if (table == NULL) forceExit("\nError: Couldn't allocate memory -- Shared Table\n");
+	unsigned long buckets = 1 << 12;
+	while (buckets < expected && buckets < (1UL << 24)) buckets *= 2;
+	table -> buckets = calloc(buckets, sizeof(SharedName *));
+	if (table -> buckets == NULL) forceExit("\nError: Couldn't allocate memory -- Shared Table\n");
+	table -> mask = buckets - 1;
+	atomic_init(&table -> size, 0);
+	return table;
+}
+
+/**
+ * @brief Counts one row for a name in the shared table
+ * 
+ * Safe to call from any number of threads at once.
+ * 
+ * @param table Table shared by the producers
+ * @param name Address location of NAME to be used
+ * @param older Count the row in before (the --diff old input) instead of count
+ * @return 1 if the name was new to the table, 0 if it was already there
+ */
+int sharedAdd(SharedTable *table, char *name, int older)
+{
+	uint64_t hash = hashName(name);
+	SharedName *_Atomic *bucket = &table -> buckets[hash & table -> mask];
+	SharedName *head = atomic_load_explicit(bucket, memory_order_acquire);
+	for (SharedName *entry = head; entry != NULL; entry = atomic_load_explicit(&entry -> next, memory_order_acquire)) {
+		if (entry -> hash == hash && strcmp(entry -> name, name) == 0) {
+			atomic_fetch_add_explicit(older ? &entry -> before : &entry -> count, 1, memory_order_relaxed);
+			return 0;
+		}
+	}
+	size_t length = strlen(name) + 1;
+	SharedName *fresh = malloc(sizeof(SharedName) + length);
+	if (fresh == NULL) forceExit("\nError: Couldn't allocate memory -- Shared Table\n");
+	atomic_init(&fresh -> count, older ? 0 : 1);
+	atomic_init(&fresh -> before, older ? 1 : 0);
+	fresh -> hash = hash;
+	memcpy(fresh -> name, name, length);
+	SharedName *checked = head;
+	while (1) {
+		atomic_store_explicit(&fresh -> next, head, memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(bucket, &head, fresh, memory_order_release, memory_order_acquire)) {
+			atomic_fetch_add_explicit(&table -> size, 1, memory_order_relaxed);
+			return 1;
+		}
+		// lost the race -- only entries pushed since the last look can hold the name
+		for (SharedName *entry = head; entry != checked; entry = atomic_load_explicit(&entry -> next, memory_order_acquire)) {
+			if (entry -> hash == hash && strcmp(entry -> name, name) == 0) {
+				free(fresh);
+				atomic_fetch_add_explicit(older ? &entry -> before : &entry -> count, 1, memory_order_relaxed);
+				return 0;
+			}
+		}
+		checked = head;
+	}
+}
+
+/**
+ * @brief Prints the current top names of the shared table
+ * 
+ * Safe to call while producers are still counting; each count is read
+ * atomically, so the snapshot is at worst a few rows behind. There's no
+ * first-seen order across threads, so ties are printed by name.
+ * 
+ * @param table Table to be ranked
+ * @param limit The num names you want printed
+ * @return void
+ */
+void printShared(SharedTable *table, int limit)
+{
+	Tweeter *top = malloc(limit * sizeof(Tweeter));
+	if (top == NULL) forceExit("\nError: Couldn't allocate memory -- Shared Table\n");
+	int size = 0;
+	for (unsigned long b = 0; b <= table -> mask; b++) {
+		SharedName *entry = atomic_load_explicit(&table -> buckets[b], memory_order_acquire);
+		for (; entry != NULL; entry = atomic_load_explicit(&entry -> next, memory_order_acquire)) {
+			int count = atomic_load_explicit(&entry -> count, memory_order_relaxed);
+			if (size == limit && (count < top[limit - 1].count
+					|| (count == top[limit - 1].count && strcmp(entry -> name, top[limit - 1].name) > 0))) {
+				continue;
+			}
+			int i = (size < limit) ? size++ : limit - 1;
+			while (i > 0 && (top[i - 1].count < count
+					|| (top[i - 1].count == count && strcmp(top[i - 1].name, entry -> name) > 0))) {
+				top[i] = top[i - 1];
+				i--;
+			}
+			top[i].name = entry -> name;
+			top[i].count = count;
+		}
+	}
+	for (int i = 0; i < size; i++) {
+		printf("%s: %d\n", top[i].name, top[i].count);
+	}
+	free(top);
+}
+
+/**
+ * @brief Frees the shared table and every name in it
+ * 
+ * @param table Table to be freed (no producer may still be running)
+ * @return void
+ */
+void freeSharedTable(SharedTable *table)
+{
+	for (unsigned long b = 0; b <= table -> mask; b++) {
+		SharedName *entry = atomic_load(&table -> buckets[b]);
+		while (entry != NULL) {
+			SharedName *next = atomic_load(&entry -> next);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(table -> buckets);
+	free(table);
+}
+
+/**
+ * @brief Reads every file at once into one shared table (--concurrent)
+ * 
+ * Headers are read up front on the main thread, then every file gets a
+ * producer thread running processData against the shared table, so
+ * FIFOs and other live streams are counted as their rows arrive. With
+ * --live the main thread prints a snapshot every few seconds while it
+ * waits. The final top 10 is printed once every producer is done.
+ * A single file with --index is instead split at indexed rows into one
+ * part per thread, each read by its own producer. With --diff the first
+ * file's producer counts into the old column of the table and the
+ * rankings are compared instead. With --metrics every producer gets its
+ * own counter block.
+ * 
+ * @param opts Options holding the files
+ * @param summary Counters reported in the run summary (totals of every producer)
+ * @return void
+ */
+void ingestConcurrently(Options *opts, Summary *summary)
+{
+	int parts = opts -> fileCount;
+	RowIndex *index = NULL;
+	if (opts -> index && opts -> fileCount == 1) {
+		// one indexed file is split at indexed rows, one part per thread
+		index = openRowIndex(opts -> files[0], summary);
+		parts = threadCount(opts);
+		if (parts > index -> entries) parts = index -> entries > 0 ? index -> entries : 1;
+	}
+	Producer *producers = malloc(parts * sizeof(Producer));
+	pthread_t *threads = malloc(parts * sizeof(pthread_t));
+	if (producers == NULL || threads == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	ConcurrentRun run;
+	run.running = parts;
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.finished, NULL);
+	unsigned long expected = 0;
+	for (int i = 0; i < parts; i++) {
+		Producer *producer = &producers[i];
+		producer -> opts = *opts;
+		producer -> run = &run;
+		memset(&producer -> summary, 0, sizeof(Summary));
+		Source *source = &producer -> source;
+		source -> path = opts -> files[index != NULL ? 0 : i];
+		source -> file = openInput(source -> path, opts);
+		if (opts -> pipeline) setvbuf(source -> file, NULL, _IONBF, 0);
+		checkFile(source -> file);
+		source -> quoted = -1;
+		source -> comma = 0;
+		source -> oneCol = -1;
+		source -> namePos = getNameIndex(source -> file, &source -> quoted, &source -> comma, &source -> oneCol,
+				&producer -> opts);
+		if (producer -> opts.dedupColumn != NULL && producer -> opts.dedupIndex == -1) {
+			forceExit("\nError: Dedup column not found\n");
+		}
+		if (index != NULL && index -> entries > 0) {
+			long first = index -> entries * i / parts, next = index -> entries * (i + 1) / parts;
+			fseek(source -> file, index -> offsets[first], SEEK_SET);
+			producer -> opts.rowLimit = (next < index -> entries ? next * index -> stride : index -> rows)
+					- first * index -> stride;
+			producer -> opts.lineBase = index -> lines[first];
+		} else if (index != NULL) {
+			producer -> opts.lineBase = 2;
+		}
+		struct stat info;
+		// about one distinct name per 64 bytes of input, a guess only used to size the buckets
+		if ((index == NULL || i == 0) && fstat(fileno(source -> file), &info) == 0 && S_ISREG(info.st_mode)) {
+			expected += info.st_size / 64;
+		}
+	}
+	if (index != NULL) freeRowIndex(index);
+	Metrics *metrics = opts -> metricsPath != NULL ? createMetrics(opts -> metricsPath, parts) : NULL;
+	for (int i = 0; metrics != NULL && i < parts; i++) producers[i].opts.metricsCounters = &metrics -> blocks[i];
+	SharedTable *table = createSharedTable(expected > 0 ? expected : 1 << 16);
+	for (int i = 0; i < parts; i++) {
+		Link *info = malloc(sizeof(Link));
+		if (info == NULL) forceExit("\nError: Couldn't allocate memory\n");
+		info -> head = info -> last = createNode(1, info);
+		info -> bytes = 0;
+		info -> spill = NULL;
+		info -> dict = NULL;
+		info -> shared = table;
+		info -> older = opts -> diff && i == 0;
+		producers[i].info = info;
+		if (pthread_create(&threads[i], NULL, produceRows, &producers[i]) != 0) {
+			forceExit("\nError: Couldn't start producer thread\n");
+		}
+	}
+	pthread_mutex_lock(&run.lock);
+	while (run.running > 0) {
+		if (opts -> liveSeconds == 0) {
+			pthread_cond_wait(&run.finished, &run.lock);
+			continue;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += opts -> liveSeconds;
+		if (pthread_cond_timedwait(&run.finished, &run.lock, &deadline) != 0 && run.running > 0) {
+			pthread_mutex_unlock(&run.lock);
+			printShared(table, opts -> topCount);
+			printf("\n");
+			fflush(stdout);
+			pthread_mutex_lock(&run.lock);
+		}
+	}
+	pthread_mutex_unlock(&run.lock);
+	if (metrics != NULL) closeMetrics(metrics);
+	for (int i = 0; i < parts; i++) {
+		pthread_join(threads[i], NULL);
+		Summary *part = &producers[i].summary;
+		summary -> rowsRead += part -> rowsRead;
+		summary -> rowsCounted += part -> rowsCounted;
+		summary -> duplicates += part -> duplicates;
+		summary -> notWatched += part -> notWatched;
+		summary -> malformedRows += part -> malformedRows;
+		summary -> bytesRead += part -> bytesRead;
+		summary -> watchlistSize = part -> watchlistSize;
+		fclose(producers[i].source.file);
+	}
+	if (opts -> diff) {
+		reportDiff(table, opts -> topCount);
+	} else {
+		printShared(table, opts -> topCount);
+	}
+	if (opts -> emitPartial != NULL) writePartial(opts -> emitPartial, NULL, producers[0].info, summary);
+	if (opts -> digest != NULL) digestTable(opts -> digest, producers[0].info);
+	if (opts -> rankPath != NULL) exportRanking(producers[0].info, opts, summary);
+	for (int i = 0; i < parts; i++) freeLinkedMemory(producers[i].info -> head, producers[i].info);
+	freeSharedTable(table);
+	pthread_mutex_destroy(&run.lock);
+	pthread_cond_destroy(&run.finished);
+	free(producers);
+	free(threads);
+}
+
+/**
+ * @brief Body of a --concurrent producer thread
+ * 
+ * @param arg The Producer
+ * @return NULL
+ */
+void *produceRows(void *arg)
+{
+	Producer *producer = arg;
+	Source *source = &producer -> source;
+	processData(source -> file, source -> namePos, producer -> info, source -> quoted, source -> comma,
+			source -> oneCol, &producer -> opts, &producer -> summary);
+	pthread_mutex_lock(&producer -> run -> lock);
+	producer -> run -> running--;
+	pthread_cond_signal(&producer -> run -> finished);
+	pthread_mutex_unlock(&producer -> run -> lock);
+	return NULL;
+}
+
+/**
+ * @brief Opens the --perf counters and starts the header phase
+ * 
+ * Events the kernel or CPU won't count (no PMU in a VM, a strict
+ * perf_event_paranoid, a seccomp filter, ...) are left out, and if none
+ * can be opened only wall-clock time is measured.
+ * 
+ * @param perf Counters to be started
+ * @return void
+ */
+void perfStart(PerfCounters *perf)
+{
+	memset(perf, 0, sizeof(PerfCounters));
+	perf -> leader = -1;
+	perf -> reason = "not supported on this platform";
+	for (int event = 0; event < PERF_EVENTS; event++) perf -> slots[event] = -1;
+#ifdef __linux__
+	uint64_t configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	for (int event = 0; event < PERF_EVENTS; event++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[event];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.disabled = perf -> leader == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf -> leader, 0);
+		if (fd == -1) {
+			if (perf -> leader == -1) perf -> reason = strerror(errno);
+			continue;
+		}
+		if (perf -> leader == -1) perf -> leader = fd;
+		perf -> slots[event] = perf -> opened++;
+	}
+	if (perf -> leader != -1) ioctl(perf -> leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	perf -> phase = PHASE_HEADER;
+	perfRead(perf, perf -> last);
+}
+
+/**
+ * @brief Reads every counter and the clock
+ * 
+ * @param perf Counters to be read
+ * @param values Set to the event counts, then wall-clock nanoseconds
+ * @return void
+ */
+void perfRead(PerfCounters *perf, uint64_t *values)
+{
+	if (perf -> leader != -1) {
+		// PERF_FORMAT_GROUP: the number of events, then their counts in opening order
+		uint64_t group[PERF_EVENTS + 1];
+		if (read(perf -> leader, group, sizeof(group)) > 0) {
+			for (int event = 0; event < PERF_EVENTS; event++) {
+				values[event] = perf -> slots[event] >= 0 ? group[1 + perf -> slots[event]] : 0;
+			}
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	values[PERF_EVENTS] = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Charges everything since the last call to the current phase
+ * 
+ * @param perf Counters of the run, NULL when --perf is off
+ * @param phase Phase the program is entering
+ * @return void
+ */
+void perfPhase(PerfCounters *perf, int phase)
+{
+	if (perf == NULL) return;
+	uint64_t now[PERF_EVENTS + 1];
+	memcpy(now, perf -> last, sizeof(now));
+	perfRead(perf, now);
+	for (int i = 0; i <= PERF_EVENTS; i++) {
+		perf -> totals[perf -> phase][i] += now[i] - perf -> last[i];
+		perf -> last[i] = now[i];
+	}
+	perf -> phase = phase;
+}
+
+/**
+ * @brief Prints the --perf report to stderr and closes the counters
+ * 
+ * Every figure is divided by the rows read, so phases that run once
+ * (header, ranking) show what they cost amortized over the file.
+ * 
+ * @param perf Counters of the run
+ * @param summary Counters holding the rows read
+ * @return void
+ */
+void perfReport(PerfCounters *perf, Summary *summary)
+{
+	char *phases[PERF_PHASES] = { "header", "read", "tokenize", "insert", "ranking" };
+	char *events[PERF_EVENTS] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+	uint64_t total[PERF_EVENTS + 1] = { 0 };
+	double rows = summary -> rowsRead > 0 ? summary -> rowsRead : 1;
+	perfPhase(perf, PHASE_RANKING);
+	fprintf(stderr, "\nPerf (main thread, user space, per row over %ld rows):\n", summary -> rowsRead);
+	if (perf -> leader == -1) fprintf(stderr, "Hardware counters unavailable (%s) -- wall-clock time only\n", perf -> reason);
+	fprintf(stderr, "%-10s %12s", "phase", "ns");
+	for (int event = 0; event < PERF_EVENTS; event++) fprintf(stderr, " %14s", events[event]);
+	fprintf(stderr, "\n");
+	for (int phase = 0; phase <= PERF_PHASES; phase++) {
+		uint64_t *values = phase < PERF_PHASES ? perf -> totals[phase] : total;
+		if (phase < PERF_PHASES) {
+			for (int i = 0; i <= PERF_EVENTS; i++) total[i] += values[i];
+		}
+		fprintf(stderr, "%-10s %12.1f", phase < PERF_PHASES ? phases[phase] : "total", values[PERF_EVENTS] / rows);
+		for (int event = 0; event < PERF_EVENTS; event++) {
+			if (perf -> slots[event] >= 0) {
+				fprintf(stderr, " %14.2f", values[event] / rows);
+			} else {
+				fprintf(stderr, " %14s", "n/a");
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+	if (perf -> leader != -1) close(perf -> leader);
+	free(perf);
+}
+
+/**
+ * @brief Checks whether a string is plain ASCII
+ * 
+ * SSE2 tests 16 bytes per instruction on x86; elsewhere 8 bytes are
+ * tested at a time in a 64-bit word.
+ * 
+ * @param text Bytes to be checked
+ * @param length Number of bytes
+ * @return 1 if no byte has its top bit set, 0 otherwise
+ */
+int isAscii(const char *text, size_t length)
+{
+	size_t i = 0;
+#if defined(__x86_64__)
+	for (; i + 16 <= length; i += 16) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (text + i))) != 0) return 0;
+	}
+#endif
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		memcpy(&word, text + i, 8);
+		if (word & 0x8080808080808080ULL) return 0;
+	}
+	for (; i < length; i++) {
+		if ((unsigned char) text[i] >= 0x80) return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Lowercases the ASCII letters of a string in place, 8 bytes at a time
+ * 
+ * The top bit of every byte is masked off first, so no add carries into
+ * the next byte. Then adding 0x3f sets the top bit from 'A' up and adding
+ * 0x25 sets it from 'Z' + 1 up, so their difference marks the capitals;
+ * bytes of 0x80 and up are dropped from the mask, and shifted down it is
+ * the 0x20 that lowercases the capitals. Other bytes are left as they are.
+ * 
+ * @param text Bytes to be lowercased (ASCII or not)
+ * @param length Number of bytes
+ * @return void
+ */
+void lowerAscii(char *text, size_t length)
+{
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		memcpy(&word, text + i, 8);
+		uint64_t low = word & 0x7f7f7f7f7f7f7f7fULL;
+		uint64_t capitals = ((low + 0x3f3f3f3f3f3f3f3fULL) ^ (low + 0x2525252525252525ULL)) & ~word & 0x8080808080808080ULL;
+		word |= capitals >> 2;
+		memcpy(text + i, &word, 8);
+	}
+	for (; i < length; i++) {
+		if (text[i] >= 'A' && text[i] <= 'Z') text[i] += 'a' - 'A';
+	}
+}
+
+/**
+ * @brief Checks whether bytes are well-formed UTF-8
+ * 
+ * Uses the SSSE3 validator when the CPU has it, else the scalar one.
+ * 
+ * @param text Bytes to be checked
+ * @param length Number of bytes
+ * @return 1 if valid, 0 otherwise
+ */
+int validUtf8(const char *text, size_t length)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("ssse3")) return validUtf8Ssse3(text, length);
+#endif
+	return validUtf8Scalar(text, length);
+}
+
+/**
+ * @brief Checks UTF-8 one sequence at a time
+ * 
+ * Runs of ASCII are skipped 8 bytes at a time. Overlong forms,
+ * surrogates and code points past U+10FFFF are rejected.
+ * 
+ * @param text Bytes to be checked
+ * @param length Number of bytes
+ * @return 1 if valid, 0 otherwise
+ */
+int validUtf8Scalar(const char *text, size_t length)
+{
+	const unsigned char *bytes = (const unsigned char *) text;
+	size_t i = 0;
+	while (i < length) {
+		uint64_t word;
+		if (i + 8 <= length && (memcpy(&word, bytes + i, 8), (word & 0x8080808080808080ULL) == 0)) {
+			i += 8;
+			continue;
+		}
+		unsigned char lead = bytes[i];
+		if (lead < 0x80) {
+			i++;
+			continue;
+		}
+		int extra;
+		uint32_t smallest;
+		if (lead >= 0xc2 && lead <= 0xdf) {
+			extra = 1;
+			smallest = 0x80;
+		} else if ((lead & 0xf0) == 0xe0) {
+			extra = 2;
+			smallest = 0x800;
+		} else if (lead >= 0xf0 && lead <= 0xf4) {
+			extra = 3;
+			smallest = 0x10000;
+		} else {
+			return 0;
+		}
+		if (length - i <= (size_t) extra) return 0;
+		uint32_t code = lead & (0x3f >> extra);
+		for (int k = 1; k <= extra; k++) {
+			if ((bytes[i + k] & 0xc0) != 0x80) return 0;
+			code = code << 6 | (bytes[i + k] & 0x3f);
+		}
+		if (code < smallest || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return 0;
+		i += extra + 1;
+	}
+	return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Checks UTF-8 16 bytes at a time with SSSE3
+ * 
+ * This is the lookup algorithm of Keiser and Lemire ("Validating UTF-8
+ * in less than one instruction per byte"). Every byte is classified
+ * together with the byte before it by three 16-entry table lookups
+ * (pshufb), one on each nibble involved; their AND is non-zero exactly
+ * where the pair can't occur in valid UTF-8. The third and fourth bytes
+ * of long sequences are checked against the lead bytes 2 and 3 back.
+ * ASCII blocks only have to check nothing was left unfinished before
+ * them.
+ * 
+ * @param text Bytes to be checked
+ * @param length Number of bytes
+ * @return 1 if valid, 0 otherwise
+ */
+__attribute__((target("ssse3")))
+int validUtf8Ssse3(const char *text, size_t length)
+{
+	// indexed by the high nibble of the first byte of the pair
+	const __m128i firstHigh = _mm_setr_epi8(
+			UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+			UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+			(char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS,
+			UTF8_TOO_SHORT | UTF8_OVERLONG_2, UTF8_TOO_SHORT,
+			UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+			UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+	// indexed by the low nibble of the first byte
+	const __m128i firstLow = _mm_setr_epi8(
+			(char) (UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+			(char) (UTF8_CARRY | UTF8_OVERLONG_2), (char) UTF8_CARRY, (char) UTF8_CARRY,
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+			(char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000));
+	// indexed by the high nibble of the second byte
+	const __m128i secondHigh = _mm_setr_epi8(
+			UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+			UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+			(char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+			(char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+			(char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+			(char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+			UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+	// a block ending in any of these lead bytes is still waiting for continuations
+	const __m128i lastComplete = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			(char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1));
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	__m128i previous = _mm_setzero_si128();
+	__m128i error = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	unsigned char tail[16];
+	for (size_t i = 0; i < length; i += 16) {
+		__m128i input;
+		if (length - i >= 16) {
+			input = _mm_loadu_si128((const __m128i *) (text + i));
+		} else {
+			// zero padding reads as ASCII, so a sequence cut short still fails
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, text + i, length - i);
+			input = _mm_loadu_si128((const __m128i *) tail);
+		}
+		if (_mm_movemask_epi8(input) == 0) {
+			error = _mm_or_si128(error, incomplete);
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+			__m128i special = _mm_and_si128(
+					_mm_and_si128(_mm_shuffle_epi8(firstHigh, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+						_mm_shuffle_epi8(firstLow, _mm_and_si128(prev1, nibble))),
+					_mm_shuffle_epi8(secondHigh, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+			__m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), _mm_set1_epi8((char) (0xe0 - 1)));
+			__m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), _mm_set1_epi8((char) (0xf0 - 1)));
+			__m128i mustContinue = _mm_and_si128(_mm_cmpgt_epi8(_mm_or_si128(third, fourth), _mm_setzero_si128()),
+					_mm_set1_epi8((char) 0x80));
+			error = _mm_or_si128(error, _mm_xor_si128(mustContinue, special));
+			incomplete = _mm_subs_epu8(input, lastComplete);
+		}
+		previous = input;
+	}
+	error = _mm_or_si128(error, incomplete);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+#endif
+
+/**
+ * @brief Maps a code point to its case-folded (and compatibility) form
+ * 
+ * Covers ASCII, Latin-1, Latin Extended-A, Greek, Cyrillic and the
+ * fullwidth ASCII forms. No mapping makes the UTF-8 encoding longer,
+ * which is what lets foldName work in place.
+ * 
+ * @param code Code point to be folded
+ * @return The folded code point
+ */
+uint32_t foldCodePoint(uint32_t code)
+{
+	if (code >= 0xff01 && code <= 0xff5e) code -= 0xfee0;	// fullwidth ASCII
+	if (code < 0x80) return (code >= 'A' && code <= 'Z') ? code + ('a' - 'A') : code;
+	if (code >= 0xc0 && code <= 0xde && code != 0xd7) return code + 0x20;
+	if (code == 0xb5) return 0x3bc;	// micro sign -> mu
+	if (code == 0x178) return 0xff;
+	if (code == 0x17f) return 's';	// long s
+	if (code >= 0x100 && code <= 0x17e) {
+		// upper and lower case sit side by side, capital on the odd code point in two runs
+		if (code == 0x130 || code == 0x131 || code == 0x138 || code == 0x149) return code;
+		int oddCapital = (code >= 0x139 && code <= 0x148) || code >= 0x179;
+		return (code & 1) == (uint32_t) oddCapital ? code + 1 : code;
+	}
+	if (code >= 0x391 && code <= 0x3a9 && code != 0x3a2) return code + 0x20;
+	if (code == 0x3c2) return 0x3c3;	// final sigma
+	if (code >= 0x410 && code <= 0x42f) return code + 0x20;
+	if (code >= 0x400 && code <= 0x40f) return code + 0x50;
+	return code;
+}
+
+/**
+ * @brief Composes a lowercase Latin letter and a combining mark
+ * 
+ * Only the marks names are realistically decomposed with (grave, acute,
+ * circumflex, tilde, diaeresis, ring, cedilla, caron) are covered.
+ * 
+ * @param base Code point before the mark
+ * @param mark Code point which may be a combining mark
+ * @return The precomposed code point, or 0 if the pair doesn't compose
+ */
+uint32_t composeMark(uint32_t base, uint32_t mark)
+{
+	uint32_t marks[] = { 0x300, 0x301, 0x302, 0x303, 0x308, 0x30a, 0x327, 0x30c };
+	char *bases[] = { "aeiou", "aeiouy", "aeiou", "aon", "aeiouy", "a", "c", "cszenr" };
+	uint32_t composed[][6] = {
+		{ 0xe0, 0xe8, 0xec, 0xf2, 0xf9 },
+		{ 0xe1, 0xe9, 0xed, 0xf3, 0xfa, 0xfd },
+		{ 0xe2, 0xea, 0xee, 0xf4, 0xfb },
+		{ 0xe3, 0xf5, 0xf1 },
+		{ 0xe4, 0xeb, 0xef, 0xf6, 0xfc, 0xff },
+		{ 0xe5 },
+		{ 0xe7 },
+		{ 0x10d, 0x161, 0x17e, 0x11b, 0x148, 0x159 }
+	};
+	if (base < 'a' || base > 'z') return 0;
+	for (int m = 0; m < 8; m++) {
+		if (marks[m] != mark) continue;
+		char *found = strchr(bases[m], (int) base);
+		return found != NULL ? composed[m][found - bases[m]] : 0;
+	}
+	return 0;
+}
+
+/**
+ * @brief Folds a name in place into the key --fold groups by
+ * 
+ * All-ASCII names, by far the common case, are just lowercased. Other
+ * names are decoded, case-folded code point by code point and common
+ * decomposed accents are composed, so "Bob", "BOB" and "bob", or "José"
+ * typed with either form of the é, count as one tweeter. Malformed
+ * UTF-8 only has its ASCII letters lowercased.
+ * 
+ * @param name Address location of NAME to be folded
+ * @return void
+ */
+void foldName(char *name)
+{
+	size_t length = strlen(name);
+	if (isAscii(name, length) || !validUtf8(name, length)) {
+		lowerAscii(name, length);
+		return;
+	}
+	unsigned char *in = (unsigned char *) name;
+	unsigned char *out = in;
+	unsigned char *previousAt = NULL;
+	uint32_t previous = 0;
+	for (size_t i = 0; i < length;) {
+		unsigned char lead = in[i];
+		int extra = lead < 0x80 ? 0 : lead < 0xe0 ? 1 : lead < 0xf0 ? 2 : 3;
+		uint32_t code = extra == 0 ? lead : lead & (0x3f >> extra);
+		for (int k = 1; k <= extra; k++) code = code << 6 | (in[i + k] & 0x3f);
+		i += extra + 1;
+		if (code == 0xdf) {
+			// sharp s folds to "ss", the same two bytes long
+			*out++ = 's';
+			*out++ = 's';
+			previousAt = NULL;
+			continue;
+		}
+		code = foldCodePoint(code);
+		uint32_t pair = previousAt != NULL ? composeMark(previous, code) : 0;
+		if (pair != 0) {
+			out = previousAt;
+			code = pair;
+		}
+		previousAt = out;
+		previous = code;
+		if (code < 0x80) {
+			*out++ = code;
+		} else if (code < 0x800) {
+			*out++ = 0xc0 | code >> 6;
+			*out++ = 0x80 | (code & 0x3f);
+		} else if (code < 0x10000) {
+			*out++ = 0xe0 | code >> 12;
+			*out++ = 0x80 | (code >> 6 & 0x3f);
+			*out++ = 0x80 | (code & 0x3f);
+		} else {
+			*out++ = 0xf0 | code >> 18;
+			*out++ = 0x80 | (code >> 12 & 0x3f);
+			*out++ = 0x80 | (code >> 6 & 0x3f);
+			*out++ = 0x80 | (code & 0x3f);
+		}
+	}
+	*out = '\0';
+}
+
+/**
+ * @brief Estimates the top names from randomly chosen blocks (--sample)
+ * 
+ * The data after the header is cut into equal blocks, and blocks are
+ * read in random order (without repeats) in rounds of SAMPLE_ROUND. A
+ * row belongs to the block it starts in, so every row is equally likely
+ * to be sampled. After each round the current top count is compared to
+ * the last one; once it has held for SAMPLE_STABLE_ROUNDS rounds the
+ * sampling stops. Counts are scaled by data bytes over sampled bytes and
+ * printed with a 95% Wilson interval, which treats the sampled rows as
+ * independent. If every block ends up read, the counts are exact and
+ * printed as usual.
+ * 
+ * Blocks are drawn from a fixed seed, so repeated runs give the same
+ * estimate.
+ * 
+ * @param file The CSV, positioned right after its header
+ * @param namePos Index of NAME value in CSV line
+ * @param opts Options selecting the optional stages
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void sampleFile(FILE *file, int namePos, int quoted, int comma, int oneCol, Options *opts, Summary *summary)
+{
+	struct stat status;
+	if (fstat(fileno(file), &status) != 0 || !S_ISREG(status.st_mode)) {
+		forceExit("\nError: --sample needs a plain (uncompressed) regular file\n");
+	}
+	long dataStart = ftell(file);
+	long dataBytes = status.st_size - dataStart;
+	long blockBytes = SAMPLE_BLOCK;
+	// small files get smaller blocks, so a sample is still a small part of the file
+	while (blockBytes > 4096 && dataBytes / blockBytes < 1024) blockBytes /= 2;
+	unsigned long slots = dataBytes > 0 ? (dataBytes + blockBytes - 1) / blockBytes : 0;
+	unsigned long *order = malloc((slots > 0 ? slots : 1) * sizeof(unsigned long));
+	char *buffer = malloc(blockBytes + MAX_CHAR + 2);
+	Tweeter *top = malloc(opts -> topCount * sizeof(Tweeter));
+	long *previous = calloc(opts -> topCount, sizeof(long));
+	Link *info = malloc(sizeof(Link));
+	if (order == NULL || buffer == NULL || top == NULL || previous == NULL || info == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Sample\n");
+	}
+	info -> head = info -> last = createNode(1, info);
+	info -> bytes = 0;
+	info -> spill = NULL;
+	info -> shared = NULL;
+	info -> dict = createDictionary();
+	Watchlist *watch = opts -> onlyNames != NULL ? loadWatchlist(opts -> onlyNames, opts -> fold) : NULL;
+	if (watch != NULL) summary -> watchlistSize = watch -> size;
+	for (unsigned long i = 0; i < slots; i++) order[i] = i;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	long sampledBytes = 0;
+	int topSize = 0, stableRounds = 0;
+	unsigned long taken = 0;
+	while (taken < slots && stableRounds < SAMPLE_STABLE_ROUNDS) {
+		for (int b = 0; b < SAMPLE_ROUND && taken < slots; b++, taken++) {
+			// one Fisher-Yates step: the next block is drawn from those not read yet
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			unsigned long pick = taken + (state * 0x2545f4914f6cdd1dULL) % (slots - taken);
+			unsigned long slot = order[pick];
+			order[pick] = order[taken];
+			order[taken] = slot;
+			sampledBytes += sampleBlock(file, dataStart + slot * blockBytes, blockBytes, dataStart, status.st_size,
+					buffer, namePos, quoted, comma, oneCol, info, watch, opts, summary);
+		}
+		NameDictionary *dict = info -> dict;
+		topSize = 0;
+		for (unsigned long id = 0; id < dict -> size; id++) {
+			if (topSize == opts -> topCount && dict -> counts[id] <= top[topSize - 1].count) continue;
+			updateTop(top, &topSize, opts -> topCount, dict -> arena + dict -> offsets[id], dict -> counts[id]);
+		}
+		// names are compared by arena offset: growing the arena moves them, but keeps their offsets
+		int same = taken >= SAMPLE_MIN_BLOCKS;
+		for (int i = 0; i < opts -> topCount; i++) {
+			long offset = i < topSize ? top[i].name - dict -> arena : -1;
+			if (offset != previous[i]) same = 0;
+			previous[i] = offset;
+		}
+		stableRounds = same ? stableRounds + 1 : 0;
+	}
+	int exact = taken == slots;
+	double scale = (!exact && sampledBytes > 0) ? (double) dataBytes / sampledBytes : 1;
+	long rows = summary -> rowsRead;
+	summary -> sampledBlocks = taken;
+	summary -> sampleSlots = slots;
+	summary -> estimatedRows = rows * scale + 0.5;
+	for (int i = 0; i < topSize; i++) {
+		if (exact) {
+			printf("%s: %d\n", top[i].name, top[i].count);
+			continue;
+		}
+		double z = 1.96, n = rows, p = top[i].count / n;
+		double center = (p + z * z / (2 * n)) / (1 + z * z / n);
+		double half = z / (1 + z * z / n) * sqrt(p * (1 - p) / n + z * z / (4 * n * n));
+		double total = summary -> estimatedRows;
+		printf("%s: %.0f (95%% CI %.0f-%.0f)\n", top[i].name, top[i].count * scale,
+				(center - half) * total, (center + half) * total);
+	}
+	if (watch != NULL) freeWatchlist(watch);
+	freeDictionary(info -> dict);
+	freeLinkedMemory(info -> head, info);
+	free(order);
+	free(buffer);
+	free(top);
+	free(previous);
+}
+
+/**
+ * @brief Counts the rows which start inside one block of the file
+ * 
+ * The byte before the block is read too: a row starts in the block at
+ * its first byte if that byte follows a newline (or the header), else
+ * at the byte after the block's first newline. The last row is read past
+ * the end of the block to its newline. Rows are checked just like in
+ * processData.
+ * 
+ * @param file The CSV (closed on invalid rows)
+ * @param start Offset of the block
+ * @param blockBytes Size of a block
+ * @param dataStart Offset of the first row
+ * @param fileSize Size of the file
+ * @param buffer Room for blockBytes + MAX_CHAR + 2 bytes
+ * @param info Data struct holding the sample's NameDictionary
+ * @param watch Watchlist, NULL to count everyone
+ * @param opts Options selecting the optional stages
+ * @param summary Counters reported in the run summary
+ * @return The number of bytes of the rows counted
+ */
+long sampleBlock(FILE *file, long start, long blockBytes, long dataStart, long fileSize, char *buffer, int namePos,
+		int quoted, int comma, int oneCol, Link *info, Watchlist *watch, Options *opts, Summary *summary)
+{
+	long readFrom = start > dataStart ? start - 1 : start;
+	long blockEnd = start + blockBytes < fileSize ? start + blockBytes : fileSize;
+	long want = blockEnd - readFrom + MAX_CHAR + 1;
+	if (readFrom + want > fileSize) want = fileSize - readFrom;
+	ssize_t got = pread(fileno(file), buffer, want, readFrom);
+	if (got < 0) forceExit("\nError: Couldn't read CSV file\n");
+	char *end = buffer + got;
+	char *limit = buffer + (blockEnd - readFrom);
+	char *row = buffer;
+	if (start > dataStart) {
+		char *newline = memchr(buffer, '\n', got);
+		if (newline == NULL) return 0;
+		row = newline + 1;
+	}
+	long bytes = 0;
+	char line[MAX_CHAR + 1];
+	while (row < limit && row < end) {
+		char *newline = memchr(row, '\n', end - row);
+		long length = newline != NULL ? newline - row + 1 : end - row;
+		if (length >= MAX_CHAR) {
+			fclose(file);
+			forceExit("\nError: Invalid input format -- too many characters in the line\n");
+		}
+		memcpy(line, row, length);
+		line[length] = '\0';
+		row += length;
+		bytes += length;
+		if (commaCounter(line) != comma) {
+			fclose(file);
+			forceExit("\nError: Invalid input format -- wrong number of fields\n");
+		}
+		if (opts -> utf8Mode != UTF8_OFF && !validUtf8(line, length)) {
+			if (opts -> utf8Mode == UTF8_REJECT) {
+				fclose(file);
+				forceExit("\nError: Invalid input format -- malformed UTF-8\n");
+			}
+			++(summary -> malformedRows);
+		}
+		++(summary -> rowsRead);
+		char *error = NULL;
+		char *name = extractName(line, namePos, quoted, &error);
+		if (error != NULL) {
+			fclose(file);
+			forceExit(error);
+		}
+		if (oneCol == 1) trimNewLine(name);
+		if (opts -> fold && strcmp(name, "invalid") != 0) foldName(name);
+		if (strcmp(name, "invalid") == 0) {
+			fclose(file);
+			forceExit("\nError: Invalid input format -- invalid name found\n");
+		} else if (*name == '\0') {
+			name = "empty";
+		}
+		if (watch != NULL && !watchlistContains(watch, name)) {
+			++(summary -> notWatched);
+			continue;
+		}
+		dictionaryAdd(info, name);
+		++(summary -> rowsCounted);
+	}
+	return bytes;
+}
+
+/**
+ * @brief Reports an invalid row and exits, or quarantines it
+ * 
+ * With an index the row's line in the file is known even when reading
+ * started in the middle, so it is printed before the error. With
+ * --quarantine the row is written to the quarantine file instead and
+ * rowError returns, unless that pushes the share of invalid rows over
+ * the --max-error-rate.
+ * 
+ * @param fileName File being read (closed before exiting)
+ * @param exitMsg Message relating to error
+ * @param opts Options holding the line of the first row read
+ * @param row 1-based row within this read
+ * @return void
+ */
+void rowError(FILE *fileName, char *exitMsg, Options *opts, long row)
+{
+	if (opts -> metricsCounters != NULL) metricsAdd(&opts -> metricsCounters -> rejected[metricsReason(exitMsg)], 1);
+	Quarantine *quarantine = opts -> quarantine;
+	if (quarantine != NULL && quarantine -> path == NULL) {
+		// a --serve daemon's rejects: counted, never written or rate-limited
+		quarantine -> rows++;
+		return;
+	} else if (quarantine != NULL) {
+		if (quarantine -> file == NULL) {
+			quarantine -> file = fopen(quarantine -> path, "w");
+			if (quarantine -> file == NULL) forceExit("\nError: Couldn't open quarantine file\n");
+			setvbuf(quarantine -> file, NULL, _IOFBF, 1 << 16);
+		}
+		// "\nError: Invalid input format -- reason\n" is written as "reason"
+		char *reason = exitMsg + strlen("\nError: ");
+		char *format = strstr(reason, " -- ");
+		if (format != NULL) reason = format + strlen(" -- ");
+		char *line = quarantine -> line;
+		size_t length = strlen(line);
+		fprintf(quarantine -> file, "%ld\t%.*s\t%s%s", opts -> lineBase > 0 ? opts -> lineBase + row - 1 : row + 1,
+				(int) strcspn(reason, "\n"), reason, line, length > 0 && line[length - 1] == '\n' ? "" : "\n");
+		quarantine -> rows++;
+		if (row >= QUARANTINE_MIN_ROWS && quarantine -> rows > quarantine -> maxRate * row) {
+			fclose(fileName);
+			fclose(quarantine -> file);
+			forceExit("\nError: Too many invalid rows -- over --max-error-rate\n");
+		}
+		return;
+	}
+	fclose(fileName);
+	if (opts -> lineBase > 0) printf("\nLine %ld of %s:", opts -> lineBase + row - 1, opts -> fileName);
+	forceExit(exitMsg);
+}
+
+/**
+ * @brief Loads the index sidecar of a CSV, rebuilding it if it is stale
+ * 
+ * @param path Location of the CSV (the sidecar is path + ".mxi")
+ * @param summary Counters reported in the run summary
+ * @return The index (to be freed with freeRowIndex)
+ */
+RowIndex *openRowIndex(char *path, Summary *summary)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat status;
+	if (fd == -1 || fstat(fd, &status) != 0) forceExit("\nError: No file\n");
+	unsigned char magic[4];
+	if (!S_ISREG(status.st_mode) || pread(fd, magic, 4, 0) < 0 || (status.st_size >= 4 && detectFormat(magic, 4) != INPUT_PLAIN)) {
+		forceExit("\nError: --index needs a plain (uncompressed) regular file\n");
+	}
+	size_t length = strlen(path);
+	char *sidecar = malloc(length + 5);
+	if (sidecar == NULL) forceExit("\nError: Couldn't allocate memory -- Index\n");
+	memcpy(sidecar, path, length);
+	strcpy(sidecar + length, ".mxi");
+	RowIndex *index = readRowIndex(sidecar);
+	summary -> indexReused = index != NULL && index -> size == status.st_size
+			&& index -> mtimeSeconds == status.st_mtim.tv_sec && index -> mtimeNanos == status.st_mtim.tv_nsec;
+	if (!summary -> indexReused) {
+		if (index != NULL) freeRowIndex(index);
+		index = buildRowIndex(fd, &status);
+		// a read-only directory just means the index is rebuilt next time
+		writeRowIndex(sidecar, index);
+	}
+	summary -> indexedRows = index -> rows;
+	free(sidecar);
+	close(fd);
+	return index;
+}
+
+/**
+ * @brief Scans a CSV once to build its row index
+ * 
+ * @param fd Descriptor of the CSV
+ * @param status fstat of the CSV
+ * @return The new index
+ */
+RowIndex *buildRowIndex(int fd, struct stat *status)
+{
+	RowIndex *index = malloc(sizeof(RowIndex));
+	unsigned char *buffer = malloc(BLOCK_SIZE);
+	long allocated = 64;
+	if (index == NULL || buffer == NULL) forceExit("\nError: Couldn't allocate memory -- Index\n");
+	index -> size = status -> st_size;
+	index -> mtimeSeconds = status -> st_mtim.tv_sec;
+	index -> mtimeNanos = status -> st_mtim.tv_nsec;
+	index -> stride = INDEX_STRIDE;
+	index -> rows = index -> entries = 0;
+	index -> offsets = malloc(allocated * sizeof(long));
+	index -> lines = malloc(allocated * sizeof(long));
+	if (index -> offsets == NULL || index -> lines == NULL) forceExit("\nError: Couldn't allocate memory -- Index\n");
+	long newlines = 0, offset = 0;
+	ssize_t got;
+	while ((got = pread(fd, buffer, BLOCK_SIZE, offset)) > 0) {
+		for (ssize_t i = 0; i < got; i++) {
+			if (buffer[i] == '\n') {
+				newlines++;
+				// a row starts after every newline which isn't the file's last byte
+				if (offset + i + 1 >= index -> size) continue;
+				if (index -> rows % index -> stride == 0) {
+					if (index -> entries == allocated) {
+						allocated *= 2;
+						index -> offsets = realloc(index -> offsets, allocated * sizeof(long));
+						index -> lines = realloc(index -> lines, allocated * sizeof(long));
+						if (index -> offsets == NULL || index -> lines == NULL) {
+							forceExit("\nError: Couldn't allocate memory -- Index\n");
+						}
+					}
+					index -> offsets[index -> entries] = offset + i + 1;
+					index -> lines[index -> entries++] = newlines + 1;
+				}
+				index -> rows++;
+			}
+		}
+		offset += got;
+	}
+	free(buffer);
+	return index;
+}
+
+/**
+ * @brief Writes a row index sidecar
+ * 
+ * The header holds the magic, a version and what the index was built
+ * for; entries follow as varint deltas of offset and line, so a sidecar
+ * is a few bytes per stride rows.
+ * 
+ * @param path Location of the sidecar
+ * @param index Index to be written
+ * @return 1 if it was written, 0 otherwise
+ */
+int writeRowIndex(char *path, RowIndex *index)
+{
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) return 0;
+	fwrite(INDEX_MAGIC, 1, 4, out);
+	writeVarint(out, INDEX_VERSION);
+	writeVarint(out, index -> size);
+	writeVarint(out, index -> mtimeSeconds);
+	writeVarint(out, index -> mtimeNanos);
+	writeVarint(out, index -> stride);
+	writeVarint(out, index -> rows);
+	writeVarint(out, index -> entries);
+	for (long k = 0; k < index -> entries; k++) {
+		writeVarint(out, index -> offsets[k] - (k > 0 ? index -> offsets[k - 1] : 0));
+		writeVarint(out, index -> lines[k] - (k > 0 ? index -> lines[k - 1] : 0));
+	}
+	int written = !ferror(out);
+	if (fclose(out) != 0) written = 0;
+	if (!written) unlink(path);
+	return written;
+}
+
+/**
+ * @brief Reads a row index sidecar
+ * 
+ * @param path Location of the sidecar
+ * @return The index, or NULL if there's no sidecar or it can't be used
+ */
+RowIndex *readRowIndex(char *path)
+{
+	FILE *in = fopen(path, "rb");
+	if (in == NULL) return NULL;
+	char magic[4];
+	uint64_t fields[7];
+	int valid = fread(magic, 1, 4, in) == 4 && memcmp(magic, INDEX_MAGIC, 4) == 0;
+	for (int i = 0; i < 7 && valid; i++) valid = readVarint(in, &fields[i]);
+	// entries can't outnumber the bytes of the file
+	if (valid && (fields[0] != INDEX_VERSION || fields[6] > fields[1] || fields[4] == 0)) valid = 0;
+	RowIndex *index = valid ? malloc(sizeof(RowIndex)) : NULL;
+	if (index != NULL) {
+		index -> size = fields[1];
+		index -> mtimeSeconds = fields[2];
+		index -> mtimeNanos = fields[3];
+		index -> stride = fields[4];
+		index -> rows = fields[5];
+		index -> entries = fields[6];
+		index -> offsets = malloc((index -> entries + 1) * sizeof(long));
+		index -> lines = malloc((index -> entries + 1) * sizeof(long));
+		if (index -> offsets == NULL || index -> lines == NULL) forceExit("\nError: Couldn't allocate memory -- Index\n");
+		uint64_t offset = 0, line = 0, offsetDelta = 0, lineDelta = 0;
+		for (long k = 0; k < index -> entries && valid; k++) {
+			valid = readVarint(in, &offsetDelta) && readVarint(in, &lineDelta);
+			if (!valid) break;
+			offset += offsetDelta;
+			line += lineDelta;
+			index -> offsets[k] = offset;
+			index -> lines[k] = line;
+		}
+		if (!valid) {
+			freeRowIndex(index);
+			index = NULL;
+		}
+	}
+	fclose(in);
+	return index;
+}
+
+/**
+ * @brief Frees a row index
+ * 
+ * @param index Index to be freed
+ * @return void
+ */
+void freeRowIndex(RowIndex *index)
+{
+	free(index -> offsets);
+	free(index -> lines);
+	free(index);
+}
+
+/**
+ * @brief Positions the CSV at the first row to read and sets its limits
+ * 
+ * The nearest indexed row at or before --rows is looked up and the few
+ * rows after it are skipped by counting newlines, the same rule the index
+ * is built with, so the seek costs at most stride rows of reading.
+ * 
+ * @param file The CSV, just after its header
+ * @param index Row index of the CSV
+ * @param opts Options holding --rows, which get rowLimit and lineBase set
+ * @return void
+ */
+void seekToRow(FILE *file, RowIndex *index, Options *opts)
+{
+	if (opts -> firstRow == 0) {
+		opts -> lineBase = index -> entries > 0 ? index -> lines[0] : 2;
+		return;
+	}
+	if (opts -> firstRow > index -> rows) forceExit("\nError: --rows starts past the last row\n");
+	long row = opts -> firstRow - 1;
+	long entry = row / index -> stride;
+	long offset = index -> offsets[entry], line = index -> lines[entry];
+	char buffer[4096];
+	for (long skip = row - entry * index -> stride; skip > 0;) {
+		ssize_t got = pread(fileno(file), buffer, sizeof(buffer), offset);
+		if (got <= 0) forceExit("\nError: Row index doesn't match the file\n");
+		ssize_t i = 0;
+		for (; i < got && skip > 0; i++) {
+			if (buffer[i] == '\n') {
+				line++;
+				skip--;
+			}
+		}
+		offset += i;
+	}
+	fseek(file, offset, SEEK_SET);
+	opts -> lineBase = line;
+	if (opts -> lastRow > 0) opts -> rowLimit = opts -> lastRow - opts -> firstRow + 1;
+}
+
+/**
+ * @brief Creates an empty t-digest
+ * 
+ * @param compression Bound on the number of centroids (larger is more accurate)
+ * @return The pointer to the new digest
+ */
+TDigest *createDigest(double compression)
+{
+	TDigest *digest = malloc(sizeof(TDigest));
+	if (digest == NULL) forceExit("\nError: Couldn't allocate memory -- Digest\n");
+	memset(digest, 0, sizeof(TDigest));
+	digest -> compression = compression;
+	// the k1 scale function never makes more than compression centroids
+	digest -> capacity = (int) compression * (DIGEST_BUFFER + 1);
+	digest -> centroids = malloc(digest -> capacity * sizeof(Centroid));
+	if (digest -> centroids == NULL) forceExit("\nError: Couldn't allocate memory -- Digest\n");
+	return digest;
+}
+
+/**
+ * @brief Adds one tweeter's count to a t-digest
+ * 
+ * @param digest Digest to be added to
+ * @param value Tweets of the tweeter (at least 1)
+ * @return void
+ */
+void digestAdd(TDigest *digest, double value)
+{
+	int bucket = 0;
+	for (uint64_t rest = (uint64_t) value; rest > 1; rest >>= 1) bucket++;
+	digest -> histogram[bucket]++;
+	if (digest -> weight == 0 || value < digest -> min) digest -> min = value;
+	if (digest -> weight == 0 || value > digest -> max) digest -> max = value;
+	digest -> weight += 1;
+	digest -> sum += value;
+	Centroid *slot = &digest -> centroids[digest -> merged + digest -> buffered++];
+	slot -> mean = value;
+	slot -> weight = 1;
+	if (digest -> merged + digest -> buffered == digest -> capacity) compressDigest(digest);
+}
+
+/**
+ * @brief Adds every count of a table that is in memory to a t-digest
+ * 
+ * @param digest Digest to be added to
+ * @param info Data struct holding the list, dictionary or shared table
+ * @return void
+ */
+void digestTable(TDigest *digest, Link *info)
+{
+	if (info -> dict != NULL) {
+		for (unsigned long id = 0; id < info -> dict -> size; id++) digestAdd(digest, info -> dict -> counts[id]);
+	} else if (info -> shared != NULL) {
+		SharedTable *table = info -> shared;
+		for (unsigned long b = 0; b <= table -> mask; b++) {
+			for (SharedName *entry = atomic_load(&table -> buckets[b]); entry != NULL; entry = atomic_load(&entry -> next)) {
+				digestAdd(digest, atomic_load(&entry -> count));
+			}
+		}
+	} else {
+		for (Node *current = info -> head; current != NULL; current = current -> next) {
+			if (current -> user.name != NULL) digestAdd(digest, current -> user.count);
+		}
+	}
+}
+
+/**
+ * @brief Merges the buffered values of a t-digest into its centroids
+ * 
+ * Neighbouring centroids (in order of mean) are combined while the k1
+ * scale k(q) = compression / (2 pi) * asin(2q - 1) grows by at most 1
+ * across the result, so a centroid holds fewer values the closer it is
+ * to either end of the distribution.
+ * 
+ * @param digest Digest to be compressed
+ * @return void
+ */
+void compressDigest(TDigest *digest)
+{
+	int size = digest -> merged + digest -> buffered;
+	if (digest -> buffered == 0) return;
+	Centroid *centroids = digest -> centroids;
+	qsort(centroids, size, sizeof(Centroid), compareCentroids);
+	double scale = digest -> compression / (2 * M_PI);
+	double before = 0;
+	int kept = 0;
+	Centroid current = centroids[0];
+	for (int i = 1; i < size; i++) {
+		double proposed = current.weight + centroids[i].weight;
+		double low = scale * asin(2 * before / digest -> weight - 1);
+		double high = scale * asin(fmin(1, 2 * (before + proposed) / digest -> weight - 1));
+		if (high - low <= 1) {
+			current.mean += (centroids[i].mean - current.mean) * centroids[i].weight / proposed;
+			current.weight = proposed;
+		} else {
+			before += current.weight;
+			centroids[kept++] = current;
+			current = centroids[i];
+		}
+	}
+	centroids[kept++] = current;
+	digest -> merged = kept;
+	digest -> buffered = 0;
+}
+
+/**
+ * @brief qsort comparator ordering centroids by mean
+ * 
+ * @param left Address of the first Centroid
+ * @param right Address of the second Centroid
+ * @return Negative, zero or positive as left's mean is smaller, equal or larger
+ */
+int compareCentroids(const void *left, const void *right)
+{
+	double a = ((const Centroid *) left) -> mean, b = ((const Centroid *) right) -> mean;
+	return (a > b) - (a < b);
+}
+
+/**
+ * @brief Estimates a quantile from a t-digest
+ * 
+ * Each centroid's weight is taken to be spread evenly around its mean,
+ * so the estimate is interpolated between the means of the two
+ * centroids whose halves hold the requested rank, and between min (max)
+ * and the first (last) mean at the ends.
+ * 
+ * @param digest Compressed digest holding at least one value
+ * @param q Quantile between 0 and 1
+ * @return The estimated value
+ */
+double digestQuantile(TDigest *digest, double q)
+{
+	Centroid *centroids = digest -> centroids;
+	int size = digest -> merged;
+	double rank = q * digest -> weight;
+	if (size == 1 || rank <= centroids[0].weight / 2) {
+		if (centroids[0].weight <= 1) return centroids[0].mean;
+		return digest -> min + (centroids[0].mean - digest -> min) * rank / (centroids[0].weight / 2);
+	}
+	double seen = centroids[0].weight / 2;
+	for (int i = 0; i + 1 < size; i++) {
+		double step = (centroids[i].weight + centroids[i + 1].weight) / 2;
+		if (seen + step > rank) {
+			return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * (rank - seen) / step;
+		}
+		seen += step;
+	}
+	Centroid *last = &centroids[size - 1];
+	if (last -> weight <= 1) return last -> mean;
+	return fmin(digest -> max, last -> mean + (digest -> max - last -> mean) * (rank - seen) / (last -> weight / 2));
+}
+
+/**
+ * @brief Prints the --distribution report to stderr and frees the digest
+ * 
+ * @param digest Digest holding every final count
+ * @return void
+ */
+void printDistribution(TDigest *digest)
+{
+	double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	char *labels[] = { "p50", "p90", "p99", "p99.9" };
+	compressDigest(digest);
+	fprintf(stderr, "\nTweets per tweeter:\n");
+	fprintf(stderr, "Total tweets: %.0f\n", digest -> sum);
+	fprintf(stderr, "Distinct tweeters: %.0f\n", digest -> weight);
+	if (digest -> weight > 0) {
+		fprintf(stderr, "Mean: %.2f\n", digest -> sum / digest -> weight);
+		fprintf(stderr, "Min: %.0f\n", digest -> min);
+		for (int i = 0; i < 4; i++) fprintf(stderr, "%s: %.1f\n", labels[i], digestQuantile(digest, quantiles[i]));
+		fprintf(stderr, "Max: %.0f\n", digest -> max);
+		fprintf(stderr, "Histogram:\n");
+		for (int b = 0; b < 64; b++) {
+			if (digest -> histogram[b] == 0) continue;
+			uint64_t low = (uint64_t) 1 << b, high = (low << 1) - 1;
+			fprintf(stderr, "%10" PRIu64 " - %-10" PRIu64 " %lu\n", low, high, digest -> histogram[b]);
+		}
+	}
+	free(digest -> centroids);
+	free(digest);
+}
+
+/**
+ * @brief Writes the whole table, ranked, to the --all file
+ * 
+ * The table is ranked by rankTweeters and written through a large buffer
+ * with one write() per RANK_BUFFER bytes; names and counts are appended
+ * by hand rather than formatted per line.
+ * 
+ * @param info Data struct holding the list, dictionary or shared table
+ * @param opts Options holding the output path, format and thread count
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void exportRanking(Link *info, Options *opts, Summary *summary)
+{
+	long size = 0;
+	Tweeter *tweeters = collectTweeters(info, &size);
+	rankTweeters(tweeters, size, size >= RANK_PARALLEL_MIN ? threadCount(opts) : 1);
+	RankWriter writer;
+	writer.fd = open(opts -> rankPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	writer.used = 0;
+	writer.buffer = malloc(RANK_BUFFER);
+	if (writer.fd == -1) forceExit("\nError: Couldn't open ranking file\n");
+	if (writer.buffer == NULL) forceExit("\nError: Couldn't allocate memory -- Ranking\n");
+	if (opts -> rankBinary) {
+		uint32_t version = RANK_VERSION;
+		uint64_t names = size;
+		rankWrite(&writer, RANK_MAGIC, 4);
+		rankWrite(&writer, &version, sizeof(version));
+		rankWrite(&writer, &names, sizeof(names));
+		for (long i = 0; i < size; i++) {
+			uint32_t count = tweeters[i].count;
+			uint16_t length = strlen(tweeters[i].name);
+			rankWrite(&writer, &count, sizeof(count));
+			rankWrite(&writer, &length, sizeof(length));
+			rankWrite(&writer, tweeters[i].name, length);
+		}
+	} else {
+		rankWrite(&writer, "name,count\n", 11);
+		for (long i = 0; i < size; i++) {
+			char *name = tweeters[i].name;
+			if (strpbrk(name, ",\"\r\n") != NULL) {
+				// RFC 4180 quoting, doubling any quote inside the name
+				rankWrite(&writer, "\"", 1);
+				for (char *quote; (quote = strchr(name, '"')) != NULL; name = quote + 1) {
+					rankWrite(&writer, name, quote + 1 - name);
+					rankWrite(&writer, "\"", 1);
+				}
+				rankWrite(&writer, name, strlen(name));
+				rankWrite(&writer, "\"", 1);
+			} else {
+				rankWrite(&writer, name, strlen(name));
+			}
+			char digits[16];
+			int at = sizeof(digits);
+			digits[--at] = '\n';
+			unsigned int count = tweeters[i].count;
+			do {
+				digits[--at] = '0' + count % 10;
+				count /= 10;
+			} while (count > 0);
+			digits[--at] = ',';
+			rankWrite(&writer, digits + at, sizeof(digits) - at);
+		}
+	}
+	rankFlush(&writer);
+	if (close(writer.fd) != 0) forceExit("\nError: Couldn't write ranking file\n");
+	summary -> rankedNames = size;
+	free(writer.buffer);
+	free(tweeters);
+}
+
+/**
+ * @brief Appends bytes to the --all output buffer
+ * 
+ * @param writer Buffered output
+ * @param data Bytes to be written
+ * @param length Number of bytes
+ * @return void
+ */
+void rankWrite(RankWriter *writer, const void *data, size_t length)
+{
+	if (writer -> used + length > RANK_BUFFER) rankFlush(writer);
+	if (length > RANK_BUFFER) forceExit("\nError: Couldn't write ranking file\n");
+	memcpy(writer -> buffer + writer -> used, data, length);
+	writer -> used += length;
+}
+
+/**
+ * @brief Writes out the --all output buffer
+ * 
+ * @param writer Buffered output
+ * @return void
+ */
+void rankFlush(RankWriter *writer)
+{
+	char *bytes = writer -> buffer;
+	while (writer -> used > 0) {
+		ssize_t wrote = write(writer -> fd, bytes, writer -> used);
+		if (wrote <= 0) forceExit("\nError: Couldn't write ranking file\n");
+		bytes += wrote;
+		writer -> used -= wrote;
+	}
+}
+
+/**
+ * @brief Sorts tweeters by count, largest first, and equal counts by name
+ * 
+ * An LSD radix sort on the count, one byte per pass, with passes over
+ * bytes every count shares skipped. Each pass splits the array into one
+ * slice per thread: the threads histogram their slices, the histograms
+ * are turned into per-thread starting offsets, and the threads scatter
+ * their slices to those offsets. Every pass is stable, so the order of
+ * equal counts is left alone, and runs of equal counts are then sorted
+ * by name, again split across the threads.
+ * 
+ * @param tweeters Array to be sorted
+ * @param size Number of tweeters
+ * @param threads Number of threads to sort with
+ * @return void
+ */
+void rankTweeters(Tweeter *tweeters, long size, int threads)
+{
+	if (size < 2) return;
+	Tweeter *scratch = malloc(size * sizeof(Tweeter));
+	RadixJob *jobs = malloc(threads * sizeof(RadixJob));
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	long *histograms = malloc(threads * 256 * sizeof(long));
+	if (scratch == NULL || jobs == NULL || workers == NULL || histograms == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Ranking\n");
+	}
+	uint32_t differing = 0;
+	for (long i = 1; i < size; i++) differing |= radixKey(tweeters[i].count) ^ radixKey(tweeters[0].count);
+	Tweeter *from = tweeters, *to = scratch;
+	for (int shift = 0; shift < 32; shift += 8) {
+		if (((differing >> shift) & 0xff) == 0) continue;
+		for (int t = 0; t < threads; t++) {
+			jobs[t].from = from;
+			jobs[t].to = to;
+			jobs[t].begin = size * t / threads;
+			jobs[t].end = size * (t + 1) / threads;
+			jobs[t].shift = shift;
+			jobs[t].offsets = &histograms[t * 256];
+			memset(jobs[t].offsets, 0, 256 * sizeof(long));
+		}
+		runRadixJobs(jobs, workers, threads, radixHistogram);
+		// digit-major, thread-minor offsets keep each pass stable
+		long next = 0;
+		for (int digit = 0; digit < 256; digit++) {
+			for (int t = 0; t < threads; t++) {
+				long count = jobs[t].offsets[digit];
+				jobs[t].offsets[digit] = next;
+				next += count;
+			}
+		}
+		runRadixJobs(jobs, workers, threads, radixScatter);
+		Tweeter *tmp = from;
+		from = to;
+		to = tmp;
+	}
+	if (from != tweeters) memcpy(tweeters, from, size * sizeof(Tweeter));
+	for (int t = 0; t < threads; t++) {
+		jobs[t].from = tweeters;
+		jobs[t].size = size;
+		jobs[t].begin = size * t / threads;
+		jobs[t].end = size * (t + 1) / threads;
+	}
+	runRadixJobs(jobs, workers, threads, sortTies);
+	free(histograms);
+	free(workers);
+	free(jobs);
+	free(scratch);
+}
+
+/**
+ * @brief Maps a count to the radix sort key, so larger counts sort first
+ * 
+ * @param count Tweets of a tweeter
+ * @return The key
+ */
+uint32_t radixKey(int count)
+{
+	return (uint32_t) INT32_MAX - (uint32_t) count;
+}
+
+/**
+ * @brief Runs one step of rankTweeters on every job
+ * 
+ * The calling thread takes the first job itself.
+ * 
+ * @param jobs One job per thread
+ * @param workers Space for the thread ids
+ * @param threads Number of jobs
+ * @param step Function run on each job
+ * @return void
+ */
+void runRadixJobs(RadixJob *jobs, pthread_t *workers, int threads, void *(*step)(void *))
+{
+	for (int t = 1; t < threads; t++) {
+		if (pthread_create(&workers[t], NULL, step, &jobs[t]) != 0) forceExit("\nError: Couldn't start sort thread\n");
+	}
+	step(&jobs[0]);
+	for (int t = 1; t < threads; t++) pthread_join(workers[t], NULL);
+}
+
+/**
+ * @brief Counts the digits of one slice for a radix pass
+ * 
+ * @param arg The RadixJob
+ * @return NULL
+ */
+void *radixHistogram(void *arg)
+{
+	RadixJob *job = arg;
+	for (long i = job -> begin; i < job -> end; i++) {
+		job -> offsets[(radixKey(job -> from[i].count) >> job -> shift) & 0xff]++;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Moves one slice to its place for a radix pass
+ * 
+ * @param arg The RadixJob, whose offsets are where each digit goes next
+ * @return NULL
+ */
+void *radixScatter(void *arg)
+{
+	RadixJob *job = arg;
+	for (long i = job -> begin; i < job -> end; i++) {
+		job -> to[job -> offsets[(radixKey(job -> from[i].count) >> job -> shift) & 0xff]++] = job -> from[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Sorts by name every run of equal counts starting in one slice
+ * 
+ * @param arg The RadixJob
+ * @return NULL
+ */
+void *sortTies(void *arg)
+{
+	RadixJob *job = arg;
+	Tweeter *tweeters = job -> from;
+	long start = job -> begin;
+	// a run that began in the previous slice belongs to that slice's thread
+	while (start > 0 && start < job -> end && tweeters[start - 1].count == tweeters[start].count) start++;
+	while (start < job -> end) {
+		long stop = start + 1;
+		while (stop < job -> size && tweeters[stop].count == tweeters[start].count) stop++;
+		if (stop - start > 1) qsort(&tweeters[start], stop - start, sizeof(Tweeter), compareTweeterNames);
+		start = stop;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Creates the --quarantine state
+ * 
+ * The file is only created once the first invalid row turns up.
+ * 
+ * @return The pointer to the new quarantine
+ */
+Quarantine *createQuarantine(void)
+{
+	Quarantine *quarantine = malloc(sizeof(Quarantine));
+	if (quarantine == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	quarantine -> path = NULL;
+	quarantine -> file = NULL;
+	quarantine -> maxRate = 0.01;
+	quarantine -> rows = 0;
+	quarantine -> line[0] = '\0';
+	return quarantine;
+}
+
+/**
+ * @brief Checks the final error rate and closes the quarantine file
+ * 
+ * @param quarantine Quarantine of the run
+ * @param fileName File being read (closed before exiting)
+ * @param summary Counters reported in the run summary
+ * @return void
+ */
+void closeQuarantine(Quarantine *quarantine, FILE *fileName, Summary *summary)
+{
+	summary -> quarantined = quarantine -> rows;
+	if (quarantine -> file != NULL && fclose(quarantine -> file) != 0) {
+		forceExit("\nError: Couldn't write quarantine file\n");
+	}
+	quarantine -> file = NULL;
+	if (quarantine -> path != NULL && quarantine -> rows > quarantine -> maxRate * summary -> rowsRead) {
+		fclose(fileName);
+		forceExit("\nError: Too many invalid rows -- over --max-error-rate\n");
+	}
+}
+
+/**
+ * @brief Discards the rest of a line too long for the read buffer
+ * 
+ * @param fileName File being read
+ * @param reader Its BlockReader with --pipeline, NULL otherwise
+ * @return void
+ */
+void skipLine(FILE *fileName, BlockReader *reader)
+{
+	char rest[MAX_CHAR];
+	char *str;
+	do {
+		str = reader != NULL ? readBlockLine(reader, rest, sizeof(rest)) : fgets(rest, sizeof(rest), fileName);
+	} while (str != NULL && strchr(rest, '\n') == NULL);
+}
+
+/**
+ * @brief Prints how the ranking moved between the two --diff inputs
+ * 
+ * Both inputs were counted into the same shared table, so every name
+ * already holds both of its counts and no list is built for either
+ * input. Ranks come from the two count columns alone, sorted as plain
+ * integers; each report is a bounded top list picked in one pass.
+ * 
+ * @param table Table holding the old (before) and new (count) counts
+ * @param limit Number of names per report
+ * @return void
+ */
+void reportDiff(SharedTable *table, int limit)
+{
+	long size = atomic_load(&table -> size), older = 0, newer = 0;
+	DiffEntry *entries = malloc((size > 0 ? size : 1) * sizeof(DiffEntry));
+	int *beforeCounts = malloc((size > 0 ? size : 1) * sizeof(int));
+	int *afterCounts = malloc((size > 0 ? size : 1) * sizeof(int));
+	DiffEntry **top = malloc(limit * sizeof(DiffEntry *));
+	if (entries == NULL || beforeCounts == NULL || afterCounts == NULL || top == NULL) {
+		forceExit("\nError: Couldn't allocate memory -- Diff\n");
+	}
+	long i = 0;
+	for (unsigned long b = 0; b <= table -> mask; b++) {
+		for (SharedName *entry = atomic_load(&table -> buckets[b]); entry != NULL; entry = atomic_load(&entry -> next)) {
+			entries[i].name = entry -> name;
+			entries[i].before = atomic_load(&entry -> before);
+			entries[i].after = atomic_load(&entry -> count);
+			if (entries[i].before > 0) beforeCounts[older++] = entries[i].before;
+			if (entries[i].after > 0) afterCounts[newer++] = entries[i].after;
+			i++;
+		}
+	}
+	qsort(beforeCounts, older, sizeof(int), compareCountsDescending);
+	qsort(afterCounts, newer, sizeof(int), compareCountsDescending);
+	char *titles[DIFF_REPORTS] = { "Top tweeters now", "Biggest gainers", "Biggest relative gainers",
+			"New entrants", "Dropouts" };
+	for (int kind = 0; kind < DIFF_REPORTS; kind++) {
+		int found = diffTop(entries, size, kind, top, limit);
+		printf("%s%s:\n", kind > 0 ? "\n" : "", titles[kind]);
+		for (int t = 0; t < found; t++) {
+			DiffEntry *entry = top[t];
+			if (kind == DIFF_CURRENT) {
+				long now = rankOf(afterCounts, newer, entry -> after);
+				printf("%ld. %s: %d", now, entry -> name, entry -> after);
+				if (entry -> before == 0) {
+					printf(" (new)\n");
+				} else {
+					long then = rankOf(beforeCounts, older, entry -> before);
+					printf(" (was #%ld with %d", then, entry -> before);
+					if (then == now) {
+						printf(", same rank)\n");
+					} else {
+						printf(", %s %ld)\n", then > now ? "up" : "down", then > now ? then - now : now - then);
+					}
+				}
+			} else if (kind == DIFF_GAIN) {
+				printf("%s: +%d (%d -> %d)\n", entry -> name, entry -> after - entry -> before, entry -> before,
+						entry -> after);
+			} else if (kind == DIFF_RELATIVE) {
+				printf("%s: +%.1f%% (%d -> %d)\n", entry -> name, diffScore(entry, kind) * 100, entry -> before,
+						entry -> after);
+			} else {
+				printf("%s: %d\n", entry -> name, kind == DIFF_NEW ? entry -> after : entry -> before);
+			}
+		}
+	}
+	free(top);
+	free(afterCounts);
+	free(beforeCounts);
+	free(entries);
+}
+
+/**
+ * @brief Scores a name for one of the --diff reports
+ * 
+ * @param entry Name with both of its counts
+ * @param kind Report (DIFF_CURRENT ... DIFF_DROPPED)
+ * @return The score (higher ranks first), or -1 if the name isn't part of the report
+ */
+double diffScore(DiffEntry *entry, int kind)
+{
+	switch (kind) {
+	case DIFF_CURRENT:
+		return entry -> after > 0 ? entry -> after : -1;
+	case DIFF_GAIN:
+		return entry -> after > entry -> before && entry -> before > 0 ? entry -> after - entry -> before : -1;
+	case DIFF_RELATIVE:
+		return entry -> after > entry -> before && entry -> before > 0
+				? (double) (entry -> after - entry -> before) / entry -> before : -1;
+	case DIFF_NEW:
+		return entry -> before == 0 ? entry -> after : -1;
+	default:
+		return entry -> after == 0 ? entry -> before : -1;
+	}
+}
+
+/**
+ * @brief Picks the best names of one --diff report, ties by name
+ * 
+ * @param entries Every name of the table
+ * @param size Number of entries
+ * @param kind Report (DIFF_CURRENT ... DIFF_DROPPED)
+ * @param top Set to the picked names, best first
+ * @param limit Most names picked
+ * @return Number of names picked
+ */
+int diffTop(DiffEntry *entries, long size, int kind, DiffEntry **top, int limit)
+{
+	int found = 0;
+	double scores[limit];
+	for (long e = 0; e < size; e++) {
+		double score = diffScore(&entries[e], kind);
+		if (score < 0) continue;
+		if (found == limit && (score < scores[limit - 1]
+				|| (score == scores[limit - 1] && strcmp(entries[e].name, top[limit - 1] -> name) > 0))) {
+			continue;
+		}
+		int i = found < limit ? found++ : limit - 1;
+		while (i > 0 && (scores[i - 1] < score
+				|| (scores[i - 1] == score && strcmp(top[i - 1] -> name, entries[e].name) > 0))) {
+			top[i] = top[i - 1];
+			scores[i] = scores[i - 1];
+			i--;
+		}
+		top[i] = &entries[e];
+		scores[i] = score;
+	}
+	return found;
+}
+
+/**
+ * @brief Rank of a count among counts sorted largest first
+ * 
+ * Equal counts share a rank, the way the leaderboard ties would.
+ * 
+ * @param counts Counts sorted largest first
+ * @param size Number of counts
+ * @param count Count to be ranked
+ * @return 1 + the number of counts larger than count
+ */
+long rankOf(int *counts, long size, int count)
+{
+	long low = 0, high = size;
+	while (low < high) {
+		long middle = (low + high) / 2;
+		if (counts[middle] > count) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low + 1;
+}
+
+/**
+ * @brief qsort comparator ordering counts largest first
+ * 
+ * @param left Address of the first count
+ * @param right Address of the second count
+ * @return Negative, zero or positive as left is larger, equal or smaller
+ */
+int compareCountsDescending(const void *left, const void *right)
+{
+	int a = *(const int *) left, b = *(const int *) right;
+	return (a < b) - (a > b);
+}
+
+/**
+ * @brief Converts the rest of a CSV into a --build-cache file
+ *
+ * Rows get the same checks as in processData (so --utf8 and --quarantine
+ * behave the same) and every field is dictionary encoded on the way in,
+ * one NameDictionary per column. The name column holds the extracted
+ * name, so later queries don't have to strip quotes again; folding is
+ * left to the query.
+ *
+ * @param fileName Address of file location, after the header
+ * @param namePos Index of the name column
+ * @param quoted Whether the name column is quoted
+ * @param comma Number of commas per row
+ * @param oneCol Whether the name column is the only column
+ * @param opts Options holding the cache path and the header line
+ * @param summary Run summary to be filled
+ * @return void
+ */
+void buildCache(FILE *fileName, int namePos, int quoted, int comma, int oneCol, Options *opts, Summary *summary)
+{
+	long lineCount = 1;
+	uint64_t rows = 0, allocated = 1024;
+	char buff[MAX_LINE + 1];
+	char fields[MAX_LINE + 1];
+	CacheBuilder *columns = calloc(comma + 1, sizeof(CacheBuilder));
+	if (columns == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	for (int c = 0; c <= comma; c++) {
+		columns[c].values.dict = createDictionary();
+		columns[c].codes = malloc(allocated * sizeof(uint32_t));
+		if (columns[c].codes == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	}
+	while (fgets(buff, MAX_LINE + 1, fileName) != NULL) {
+		if (lineCount > MAX_LINE) {
+			fclose(fileName);
+			forceExit("\nError: CSV file greater than max line count\n");
+		}
+		++(summary -> rowsRead);
+		size_t length = strlen(buff);
+		if (opts -> quarantine != NULL) {
+			memcpy(opts -> quarantine -> line, buff, length + 1);
+			if (length == MAX_LINE && buff[length - 1] != '\n') skipLine(fileName, NULL);
+		}
+		if (commaCounter(buff) != comma) {
+			rowError(fileName, "\nError: Invalid input format -- wrong number of fields\n", opts, lineCount);
+			lineCount++;
+			continue;
+		} else if (length >= MAX_CHAR) {
+			rowError(fileName, "\nError: Invalid input format -- too many characters in the line\n", opts, lineCount);
+			lineCount++;
+			continue;
+		}
+		if (opts -> utf8Mode != UTF8_OFF && !validUtf8(buff, length)) {
+			if (opts -> utf8Mode == UTF8_REJECT) {
+				rowError(fileName, "\nError: Invalid input format -- malformed UTF-8\n", opts, lineCount);
+				lineCount++;
+				continue;
+			}
+			++(summary -> malformedRows);
+		}
+		// extractName cuts the line up, the other columns come from a copy
+		memcpy(fields, buff, length + 1);
+		char *error = NULL;
+		char *name = extractName(buff, namePos, quoted, &error);
+		if (error != NULL) {
+			rowError(fileName, error, opts, lineCount);
+			lineCount++;
+			continue;
+		}
+		if (oneCol == 1) trimNewLine(name);
+		if (strcmp(name, "invalid") == 0) {
+			rowError(fileName, "\nError: Invalid input format -- invalid name found\n", opts, lineCount);
+			lineCount++;
+			continue;
+		} else if (*name == '\0') {
+			name = "empty";
+		}
+		if (rows == allocated) {
+			allocated *= 2;
+			for (int c = 0; c <= comma; c++) {
+				columns[c].codes = realloc(columns[c].codes, allocated * sizeof(uint32_t));
+				if (columns[c].codes == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+			}
+		}
+		fields[strcspn(fields, "\r\n")] = '\0';
+		char *rest = fields;
+		for (int c = 0; c <= comma; c++) {
+			char *field = strsep(&rest, ",");
+			char *value = c == namePos ? name : field;
+			NameDictionary *dict = columns[c].values.dict;
+			long code = dictionaryFind(dict, value);
+			if (code == -1) {
+				dictionaryAdd(&columns[c].values, value);
+				code = dict -> size - 1;
+			}
+			columns[c].codes[rows] = code;
+		}
+		rows++;
+		++(summary -> rowsCounted);
+		lineCount++;
+	}
+	if (opts -> quarantine != NULL) closeQuarantine(opts -> quarantine, fileName, summary);
+	writeCache(opts -> buildCache, columns, comma + 1, namePos, opts -> headerLine, rows);
+	for (int c = 0; c <= comma; c++) {
+		freeDictionary(columns[c].values.dict);
+		free(columns[c].codes);
+	}
+	free(columns);
+}
+
+/**
+ * @brief Writes the columns read by buildCache to a cache file
+ *
+ * Columns whose values are all plain decimal integers are stored as
+ * offsets from their smallest value, in as few bytes as the range needs.
+ * Every other column stores one code per row, again in as few bytes as
+ * the number of distinct values needs, next to the values themselves.
+ * The name column is always dictionary encoded.
+ *
+ * @param path Cache file to be written
+ * @param columns One builder per CSV column
+ * @param count Number of columns
+ * @param namePos Index of the name column
+ * @param header CSV header line, cut into the column titles
+ * @param rows Number of rows in every column
+ * @return void
+ */
+void writeCache(char *path, CacheBuilder *columns, int count, int namePos, char *header, uint64_t rows)
+{
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) forceExit("\nError: Couldn't open cache file\n");
+	setvbuf(out, NULL, _IOFBF, RANK_BUFFER);
+	CacheHeader head = { .version = CACHE_VERSION, .rows = rows, .columns = count, .nameColumn = namePos };
+	memcpy(head.magic, CACHE_MAGIC, 4);
+	CacheColumn *directory = calloc(count, sizeof(CacheColumn));
+	if (directory == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	// the directory is written again once the offsets are known
+	uint64_t offset = cacheWrite(out, &head, sizeof(CacheHeader));
+	offset += cacheWrite(out, directory, count * sizeof(CacheColumn));
+	header[strcspn(header, "\r\n")] = '\0';
+	char *rest = header;
+	for (int c = 0; c < count; c++) {
+		char *title = strsep(&rest, ",");
+		directory[c].title = offset;
+		offset += cacheWrite(out, title, strlen(title) + 1);
+	}
+	for (int c = 0; c < count; c++) {
+		NameDictionary *dict = columns[c].values.dict;
+		CacheColumn *column = &directory[c];
+		column -> values = dict -> size;
+		int64_t *numbers = malloc((dict -> size + 1) * sizeof(int64_t));
+		if (numbers == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+		int integer = c != namePos && dict -> size > 0;
+		int64_t min = INT64_MAX, max = INT64_MIN;
+		for (unsigned long v = 0; v < dict -> size && integer; v++) {
+			integer = cacheInteger(dict -> arena + dict -> offsets[v], &numbers[v]);
+			if (numbers[v] < min) min = numbers[v];
+			if (numbers[v] > max) max = numbers[v];
+		}
+		if (integer) {
+			column -> type = CACHE_INTEGER;
+			column -> base = min;
+			column -> width = cacheWidth((uint64_t) max - (uint64_t) min);
+		} else {
+			column -> type = CACHE_STRING;
+			column -> width = cacheWidth(dict -> size > 0 ? dict -> size - 1 : 0);
+		}
+		unsigned char *packed = malloc(rows * column -> width + 1);
+		if (packed == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+		for (uint64_t r = 0; r < rows; r++) {
+			uint32_t code = columns[c].codes[r];
+			uint64_t value = integer ? (uint64_t) numbers[code] - (uint64_t) min : code;
+			switch (column -> width) {
+			case 1: ((uint8_t *) packed)[r] = value; break;
+			case 2: ((uint16_t *) packed)[r] = value; break;
+			case 4: ((uint32_t *) packed)[r] = value; break;
+			default: ((uint64_t *) packed)[r] = value; break;
+			}
+		}
+		column -> data = offset;
+		offset += cacheWrite(out, packed, rows * column -> width);
+		free(packed);
+		free(numbers);
+		if (integer) continue;
+		uint64_t *offsets = malloc((dict -> size + 1) * sizeof(uint64_t));
+		if (offsets == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+		for (unsigned long v = 0; v < dict -> size; v++) offsets[v] = dict -> offsets[v];
+		column -> offsets = offset;
+		offset += cacheWrite(out, offsets, dict -> size * sizeof(uint64_t));
+		column -> strings = offset;
+		column -> stringBytes = dict -> arenaSize;
+		offset += cacheWrite(out, dict -> arena, dict -> arenaSize);
+		free(offsets);
+	}
+	if (fseek(out, sizeof(CacheHeader), SEEK_SET) != 0) forceExit("\nError: Couldn't write cache file\n");
+	cacheWrite(out, directory, count * sizeof(CacheColumn));
+	if (fclose(out) != 0) forceExit("\nError: Couldn't write cache file\n");
+	free(directory);
+}
+
+/**
+ * @brief Writes one section of a cache file, padded to CACHE_ALIGN bytes
+ *
+ * @param out Cache file being written
+ * @param data Section contents
+ * @param length Number of bytes in data
+ * @return Number of bytes written, padding included
+ */
+uint64_t cacheWrite(FILE *out, const void *data, uint64_t length)
+{
+	static const char padding[CACHE_ALIGN] = { 0 };
+	uint64_t pad = (CACHE_ALIGN - length % CACHE_ALIGN) % CACHE_ALIGN;
+	if ((length > 0 && fwrite(data, length, 1, out) != 1) || (pad > 0 && fwrite(padding, pad, 1, out) != 1)) {
+		forceExit("\nError: Couldn't write cache file\n");
+	}
+	return length + pad;
+}
+
+/**
+ * @brief Picks the number of bytes a packed cache value needs
+ *
+ * @param max Largest value to be stored
+ * @return 1, 2, 4 or 8
+ */
+int cacheWidth(uint64_t max)
+{
+	if (max <= UINT8_MAX) return 1;
+	if (max <= UINT16_MAX) return 2;
+	if (max <= UINT32_MAX) return 4;
+	return 8;
+}
+
+/**
+ * @brief Parses a cache value as an integer column entry
+ *
+ * Only values that print back the same are accepted (no sign on zero,
+ * no leading zeros, no quotes), so an integer column loses nothing.
+ *
+ * @param text Field text
+ * @param value Set to the parsed value
+ * @return 1 if text is such an integer, 0 otherwise
+ */
+int cacheInteger(char *text, int64_t *value)
+{
+	int negative = text[0] == '-';
+	char *digits = text + negative;
+	int length = strlen(digits);
+	if (length == 0 || length > 18 || (digits[0] == '0' && (length > 1 || negative))) return 0;
+	int64_t parsed = 0;
+	for (int i = 0; i < length; i++) {
+		if (digits[i] < '0' || digits[i] > '9') return 0;
+		parsed = parsed * 10 + (digits[i] - '0');
+	}
+	*value = negative ? -parsed : parsed;
+	return 1;
+}
+
+/**
+ * @brief Checks that a cache column only points inside the mapped file
+ *
+ * @param column Column to be checked
+ * @param base Start of the mapped file
+ * @param size Size of the mapped file
+ * @param rows Number of rows in the cache
+ * @return 1 if the column can be read, 0 otherwise
+ */
+int cacheColumnValid(CacheColumn *column, const char *base, uint64_t size, uint64_t rows)
+{
+	int width = column -> width;
+	if ((width != 1 && width != 2 && width != 4 && width != 8) || column -> data % CACHE_ALIGN != 0
+			|| column -> data > size || rows > (size - column -> data) / width) {
+		return 0;
+	} else if (column -> title >= size || memchr(base + column -> title, '\0', size - column -> title) == NULL) {
+		return 0;
+	} else if (column -> type == CACHE_INTEGER) {
+		return 1;
+	} else if (column -> type != CACHE_STRING || column -> offsets % CACHE_ALIGN != 0 || column -> offsets > size
+			|| column -> values > (size - column -> offsets) / sizeof(uint64_t)
+			|| column -> strings > size || column -> stringBytes > size - column -> strings
+			|| (column -> values > 0 && (column -> stringBytes == 0
+			|| base[column -> strings + column -> stringBytes - 1] != '\0'))) {
+		return 0;
+	}
+	const uint64_t *offsets = (const uint64_t *) (base + column -> offsets);
+	for (uint64_t v = 0; v < column -> values; v++) {
+		if (offsets[v] >= column -> stringBytes) return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Reads one packed entry of a cache column
+ *
+ * @param column Column to be read
+ * @param base Start of the mapped file
+ * @param row Row to be read
+ * @return The row's code, or its value minus the column base
+ */
+uint64_t cacheEntry(CacheColumn *column, const char *base, uint64_t row)
+{
+	const char *data = base + column -> data;
+	switch (column -> width) {
+	case 1: return ((const uint8_t *) data)[row];
+	case 2: return ((const uint16_t *) data)[row];
+	case 4: return ((const uint32_t *) data)[row];
+	default: return ((const uint64_t *) data)[row];
+	}
+}
+
+/**
+ * @brief Counts the name codes of a cache column into their groups
+ *
+ * One loop per width keeps the common query down to a load and an
+ * increment per row; group -1 marks the names --only-names leaves out.
+ *
+ * @param column Name column
+ * @param base Start of the mapped file
+ * @param rows Number of rows in the cache
+ * @param groups Group of every code, -1 to skip it
+ * @param counts Row count of every group
+ * @param last Last row of every group
+ * @return Number of rows counted
+ */
+long countCacheCodes(CacheColumn *column, const char *base, uint64_t rows, long *groups, int *counts, uint64_t *last)
+{
+	const char *data = base + column -> data;
+	uint64_t values = column -> values;
+	long counted = 0;
+	for (uint64_t r = 0; r < rows; r++) {
+		uint64_t code;
+		switch (column -> width) {
+		case 1: code = ((const uint8_t *) data)[r]; break;
+		case 2: code = ((const uint16_t *) data)[r]; break;
+		case 4: code = ((const uint32_t *) data)[r]; break;
+		default: code = ((const uint64_t *) data)[r]; break;
+		}
+		if (code >= values) forceExit("\nError: Invalid cache file\n");
+		long group = groups[code];
+		if (group < 0) continue;
+		counts[group]++;
+		last[group] = r;
+		counted++;
+	}
+	return counted;
+}
+
+/**
+ * @brief Answers a top-tweeters query from a --build-cache file
+ *
+ * The file is mapped and only the name column (plus the --dedup column,
+ * if any) is touched. Folding and --only-names are applied once per
+ * distinct name rather than once per row. Ties are broken by the row a
+ * name was last seen on, which is the order the CSV run prints them in.
+ *
+ * @param opts Options holding the cache file and query flags
+ * @param summary Run summary to be filled
+ * @return void
+ */
+void queryCache(Options *opts, Summary *summary)
+{
+	int fd = open(opts -> fileName, O_RDONLY);
+	if (fd == -1) forceExit("\nError: Couldn't open cache file\n");
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (uint64_t) info.st_size < sizeof(CacheHeader)) {
+		close(fd);
+		forceExit("\nError: Invalid cache file\n");
+	}
+	uint64_t bytes = info.st_size;
+	const char *base = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) forceExit("\nError: Couldn't map cache file\n");
+	const CacheHeader *header = (const CacheHeader *) base;
+	if (memcmp(header -> magic, CACHE_MAGIC, 4) != 0 || header -> version != CACHE_VERSION || header -> columns == 0
+			|| header -> columns > (bytes - sizeof(CacheHeader)) / sizeof(CacheColumn)
+			|| header -> nameColumn < 0 || (uint32_t) header -> nameColumn >= header -> columns) {
+		forceExit("\nError: Invalid cache file\n");
+	}
+	uint64_t rows = header -> rows;
+	CacheColumn *directory = (CacheColumn *) (base + sizeof(CacheHeader));
+	for (uint32_t c = 0; c < header -> columns; c++) {
+		if (!cacheColumnValid(&directory[c], base, bytes, rows)) forceExit("\nError: Invalid cache file\n");
+	}
+	CacheColumn *names = &directory[header -> nameColumn];
+	if (names -> type != CACHE_STRING) forceExit("\nError: Invalid cache file\n");
+	summary -> rowsRead = rows;
+	Watchlist *watch = NULL;
+	if (opts -> onlyNames != NULL) {
+		watch = loadWatchlist(opts -> onlyNames, opts -> fold);
+		summary -> watchlistSize = watch -> size;
+	}
+	// map every distinct name to its group, once
+	const uint64_t *offsets = (const uint64_t *) (base + names -> offsets);
+	const char *strings = base + names -> strings;
+	Link folded = { 0 };
+	if (opts -> fold) folded.dict = createDictionary();
+	long *groups = malloc((names -> values + 1) * sizeof(long));
+	const char **groupNames = malloc((names -> values + 1) * sizeof(char *));
+	if (groups == NULL || groupNames == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	char key[MAX_LINE + 1];
+	for (uint64_t v = 0; v < names -> values; v++) {
+		long group = v;
+		const char *name = strings + offsets[v];
+		if (opts -> fold) {
+			snprintf(key, sizeof(key), "%s", name);
+			foldName(key);
+			if (strcmp(key, "invalid") == 0) forceExit("\nError: Invalid input format -- invalid name found\n");
+			if (*key == '\0') strcpy(key, "empty");
+			group = dictionaryFind(folded.dict, key);
+			if (group == -1) {
+				dictionaryAdd(&folded, key);
+				group = folded.dict -> size - 1;
+			}
+		} else {
+			groupNames[v] = name;
+		}
+		groups[v] = group;
+	}
+	long groupCount = opts -> fold ? (long) folded.dict -> size : (long) names -> values;
+	if (opts -> fold) {
+		for (long g = 0; g < groupCount; g++) groupNames[g] = folded.dict -> arena + folded.dict -> offsets[g];
+	}
+	if (watch != NULL) {
+		for (uint64_t v = 0; v < names -> values; v++) {
+			if (!watchlistContains(watch, (char *) groupNames[groups[v]])) groups[v] = -1;
+		}
+	}
+	int *counts = calloc(groupCount + 1, sizeof(int));
+	uint64_t *last = calloc(groupCount + 1, sizeof(uint64_t));
+	if (counts == NULL || last == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	if (opts -> dedupColumn == NULL) {
+		summary -> rowsCounted = countCacheCodes(names, base, rows, groups, counts, last);
+	} else {
+		CacheColumn *ids = NULL;
+		for (uint32_t c = 0; c < header -> columns && ids == NULL; c++) {
+			if (matchesColumn((char *) base + directory[c].title, opts -> dedupColumn)) {
+				ids = &directory[c];
+				opts -> dedupIndex = c;
+			}
+		}
+		if (ids == NULL) forceExit("\nError: Dedup column not found\n");
+		// string ids are parsed once per distinct value, 0 marks an empty id
+		uint64_t *idOf = NULL;
+		char *hasId = NULL;
+		if (ids -> type == CACHE_STRING) {
+			idOf = malloc((ids -> values + 1) * sizeof(uint64_t));
+			hasId = malloc(ids -> values + 1);
+			if (idOf == NULL || hasId == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+			const uint64_t *idOffsets = (const uint64_t *) (base + ids -> offsets);
+			for (uint64_t v = 0; v < ids -> values; v++) {
+				char *field = (char *) base + ids -> strings + idOffsets[v];
+				int length = strlen(field);
+				hasId[v] = length > 0;
+				if (length > 0 && !parseId(field, length, &idOf[v])) {
+					forceExit("\nError: Invalid input format -- invalid id found\n");
+				}
+			}
+		}
+		IdSet *seen = createIdSet();
+		for (uint64_t r = 0; r < rows; r++) {
+			uint64_t entry = cacheEntry(ids, base, r);
+			if (ids -> type == CACHE_STRING && entry >= ids -> values) forceExit("\nError: Invalid cache file\n");
+			if (ids -> type == CACHE_INTEGER || hasId[entry]) {
+				uint64_t id = ids -> type == CACHE_INTEGER ? entry + (uint64_t) ids -> base : idOf[entry];
+				if (!idSetInsert(seen, id)) {
+					++(summary -> duplicates);
+					continue;
+				}
+			}
+			uint64_t code = cacheEntry(names, base, r);
+			if (code >= names -> values) forceExit("\nError: Invalid cache file\n");
+			long group = groups[code];
+			if (group < 0) continue;
+			counts[group]++;
+			last[group] = r;
+			++(summary -> rowsCounted);
+		}
+		freeIdSet(seen);
+		free(idOf);
+		free(hasId);
+	}
+	summary -> notWatched = rows - summary -> duplicates - summary -> rowsCounted;
+	// the top list: most rows first, then the earliest last row
+	long *top = malloc((opts -> topCount + 1) * sizeof(long));
+	if (top == NULL) forceExit("\nError: Couldn't allocate memory -- Cache\n");
+	int size = 0;
+	for (long g = 0; g < groupCount; g++) {
+		if (counts[g] == 0) continue;
+		int i = size < opts -> topCount ? size++ : size;
+		while (i > 0 && (counts[top[i - 1]] < counts[g]
+				|| (counts[top[i - 1]] == counts[g] && last[top[i - 1]] > last[g]))) {
+			if (i < opts -> topCount) top[i] = top[i - 1];
+			i--;
+		}
+		if (i < opts -> topCount) top[i] = g;
+	}
+	for (int i = 0; i < size; i++) printf("%s: %d\n", groupNames[top[i]], counts[top[i]]);
+	free(top);
+	free(counts);
+	free(last);
+	free(groups);
+	free(groupNames);
+	if (folded.dict != NULL) freeDictionary(folded.dict);
+	if (watch != NULL) freeWatchlist(watch);
+	munmap((void *) base, bytes);
+}
+
+/**
+ * @brief Counts a set of shard files, reusing their cached count tables
+ *
+ * Every shard has an entry in the --shard-cache directory: a ShardKey
+ * followed by the shard's count table as a partial result. A shard whose
+ * key still matches is not parsed at all -- its table is read back from
+ * the entry. The others are counted on their own and their entries
+ * rewritten. All tables are added up in one dictionary, so the result is
+ * the --compact leaderboard of all the shards read as one file.
+ *
+ * @param opts Options holding the shard files and the cache directory
+ * @param summary Run summary to be filled
+ * @return void
+ */
+void countShards(Options *opts, Summary *summary)
+{
+	if (mkdir(opts -> shardCache, 0777) != 0 && errno != EEXIST) {
+		forceExit("\nError: Couldn't create shard cache directory\n");
+	}
+	Link *total = calloc(1, sizeof(Link));
+	if (total == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	total -> dict = createDictionary();
+	char entry[PATH_MAX + 32];
+	char temporary[PATH_MAX + 40];
+	for (int i = 0; i < opts -> fileCount; i++) {
+		char *path = opts -> files[i];
+		ShardKey key;
+		shardKey(path, &key, opts);
+		char resolved[PATH_MAX];
+		uint64_t name = hashName(realpath(path, resolved) != NULL ? resolved : path);
+		snprintf(entry, sizeof(entry), "%s/%016" PRIx64 ".mxs", opts -> shardCache, name);
+		ShardKey cached;
+		FILE *in = fopen(entry, "rb");
+		int reuse = in != NULL && fread(&cached, sizeof(ShardKey), 1, in) == 1
+				&& memcmp(&cached, &key, offsetof(ShardKey, rowsRead)) == 0;
+		if (in != NULL) fclose(in);
+		if (reuse) {
+			PartialReader reader;
+			openPartial(&reader, entry, sizeof(ShardKey), summary);
+			reader.unordered = 1;
+			while (nextPartialRecord(&reader)) dictionaryMerge(total, reader.name, reader.count);
+			fclose(reader.file);
+			summary -> rowsRead += cached.rowsRead;
+			summary -> malformedRows += cached.malformedRows;
+			summary -> shardsReused++;
+			continue;
+		}
+		Link *shard = calloc(1, sizeof(Link));
+		if (shard == NULL) forceExit("\nError: Couldn't allocate memory\n");
+		shard -> dict = createDictionary();
+		Summary part = { 0 };
+		FILE *fileName = openInput(path, opts);
+		checkFile(fileName);
+		int quoted = -1;
+		int comma = 0;
+		int oneCol = -1;
+		int namePos = getNameIndex(fileName, &quoted, &comma, &oneCol, opts);
+		processData(fileName, namePos, shard, quoted, comma, oneCol, opts, &part);
+		fclose(fileName);
+		key.rowsRead = part.rowsRead;
+		key.malformedRows = part.malformedRows;
+		// written aside and renamed, so an interrupted run leaves no half entry
+		snprintf(temporary, sizeof(temporary), "%s.tmp", entry);
+		writePartial(temporary, &key, shard, &part);
+		if (rename(temporary, entry) != 0) forceExit("\nError: Couldn't write shard cache entry\n");
+		NameDictionary *dict = shard -> dict;
+		for (unsigned long id = 0; id < dict -> size; id++) {
+			dictionaryMerge(total, dict -> arena + dict -> offsets[id], dict -> counts[id]);
+		}
+		summary -> rowsRead += part.rowsRead;
+		summary -> rowsCounted += part.rowsCounted;
+		summary -> malformedRows += part.malformedRows;
+		summary -> shardsParsed++;
+		freeDictionary(dict);
+		free(shard);
+	}
+	printDictionary(total -> dict, opts -> topCount);
+	if (opts -> digest != NULL) digestTable(opts -> digest, total);
+	freeDictionary(total -> dict);
+	free(total);
+}
+
+/**
+ * @brief Works out the cache key of a shard file
+ *
+ * The key holds the file's size and modification time, a hash of its
+ * header line and the options that change its counts. With --shard-hash
+ * it also holds a hash of the whole file, for files that are rewritten
+ * without their size or time changing.
+ *
+ * @param path Shard file
+ * @param key Set to the shard's key
+ * @param opts Options of the run
+ * @return void
+ */
+void shardKey(char *path, ShardKey *key, Options *opts)
+{
+	struct stat info;
+	if (stat(path, &info) != 0) forceExit("\nError: No file\n");
+	memset(key, 0, sizeof(ShardKey));
+	memcpy(key -> magic, SHARD_MAGIC, 4);
+	key -> version = SHARD_VERSION;
+	key -> size = info.st_size;
+	key -> mtimeSeconds = info.st_mtim.tv_sec;
+	key -> mtimeNanos = info.st_mtim.tv_nsec;
+	key -> options = opts -> fold | opts -> utf8Mode << 1 | opts -> shardHash << 3;
+	char buff[MAX_LINE + 1];
+	FILE *file = openInput(path, opts);
+	if (fgets(buff, MAX_LINE + 1, file) != NULL) key -> header = hashName(buff);
+	fclose(file);
+	if (opts -> shardHash) key -> content = hashFile(path);
+}
+
+/**
+ * @brief Hashes the bytes of a file, eight at a time
+ *
+ * @param path File to be hashed
+ * @return 64-bit hash of the file's contents
+ */
+uint64_t hashFile(char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) forceExit("\nError: No file\n");
+	unsigned char *buffer = malloc(SHARD_HASH_BUFFER);
+	if (buffer == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (;;) {
+		size_t length = 0;
+		ssize_t got = 0;
+		// only the last block may be short, so blocks split the same way every time
+		while (length < SHARD_HASH_BUFFER && (got = read(fd, buffer + length, SHARD_HASH_BUFFER - length)) > 0) {
+			length += got;
+		}
+		if (got < 0) forceExit("\nError: Couldn't read shard file\n");
+		size_t words = length / sizeof(uint64_t);
+		for (size_t w = 0; w < words; w++) {
+			uint64_t word;
+			memcpy(&word, buffer + w * sizeof(uint64_t), sizeof(uint64_t));
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash ^= hash >> 29;
+		}
+		for (size_t b = words * sizeof(uint64_t); b < length; b++) {
+			hash ^= buffer[b];
+			hash *= 0x100000001b3ULL;
+		}
+		if (length < SHARD_HASH_BUFFER) break;
+	}
+	close(fd);
+	free(buffer);
+	return hash;
+}
+
+/**
+ * @brief Adds a name's count from another table to a dictionary
+ *
+ * @param info Data struct which holds the dictionary
+ * @param name Address location of NAME to be added
+ * @param count Number of rows the name had in the other table
+ * @return void
+ */
+void dictionaryMerge(Link *info, char *name, int count)
+{
+	NameDictionary *dict = info -> dict;
+	long id = dictionaryFind(dict, name);
+	if (id == -1) {
+		dictionaryAdd(info, name);
+		id = dict -> size - 1;
+		count--;
+	}
+	dict -> counts[id] += count;
+}
+
+/**
+ * @brief Creates (or takes over) the --publish shared-memory segment
+ *
+ * The segment is left in place when the run ends, so readers can still
+ * see the final leaderboard; it is removed with shm_unlink or by deleting
+ * it from /dev/shm. A segment left by an earlier run keeps its sequence
+ * number, so a reader mapped across runs never sees it go backwards.
+ *
+ * @param name Segment name, with or without the leading slash
+ * @param capacity Number of names published
+ * @return The publisher
+ */
+Publisher *createPublisher(char *name, int capacity)
+{
+	char path[NAME_MAX + 2];
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+	if (fd == -1) forceExit("\nError: Couldn't open shared memory segment\n");
+	size_t bytes = sizeof(Published) + capacity * sizeof(PublishedName);
+	struct stat info;
+	if (fstat(fd, &info) != 0 || ((size_t) info.st_size < bytes && ftruncate(fd, bytes) != 0)) {
+		close(fd);
+		forceExit("\nError: Couldn't size shared memory segment\n");
+	}
+	Published *segment = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED) forceExit("\nError: Couldn't map shared memory segment\n");
+	Publisher *publisher = malloc(sizeof(Publisher));
+	Tweeter *top = malloc(capacity * sizeof(Tweeter));
+	if (publisher == NULL || top == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	publisher -> segment = segment;
+	publisher -> bytes = bytes;
+	publisher -> top = top;
+	publisher -> nextRow = 0;
+	uint64_t sequence = memcmp(segment -> magic, PUBLISH_MAGIC, 4) == 0
+			? atomic_load_explicit(&segment -> sequence, memory_order_relaxed) : 0;
+	atomic_store_explicit(&segment -> sequence, sequence | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(segment -> magic, PUBLISH_MAGIC, 4);
+	segment -> version = PUBLISH_VERSION;
+	segment -> capacity = capacity;
+	segment -> size = 0;
+	segment -> rowsRead = 0;
+	segment -> rowsCounted = 0;
+	segment -> offset = 0;
+	segment -> updatedNanos = 0;
+	segment -> finished = 0;
+	atomic_store_explicit(&segment -> sequence, (sequence | 1) + 1, memory_order_release);
+	return publisher;
+}
+
+/**
+ * @brief Publishes the current top names to the --publish segment
+ *
+ * The ranking is taken before the seqlock is entered, so readers only
+ * ever wait for a copy of the top names. With --compact the ranking is
+ * a scan of the dictionary, so the next batch is at least as many rows
+ * as there are names, which keeps the cost per row constant.
+ *
+ * @param publisher The run's publisher
+ * @param info Data struct which holds the list or dictionary
+ * @param summary Counters of the run so far
+ * @param finished Whether this is the last snapshot of the run
+ * @return void
+ */
+void publishTop(Publisher *publisher, Link *info, Summary *summary, int finished)
+{
+	Published *segment = publisher -> segment;
+	Tweeter *top = publisher -> top;
+	int limit = segment -> capacity, size = 0;
+	long batch = PUBLISH_BATCH;
+	if (info -> dict != NULL) {
+		NameDictionary *dict = info -> dict;
+		for (unsigned long id = 0; id < dict -> size; id++) {
+			if (size == limit && dict -> counts[id] <= top[limit - 1].count) continue;
+			updateTop(top, &size, limit, dict -> arena + dict -> offsets[id], dict -> counts[id]);
+		}
+		if ((long) dict -> size > batch) batch = dict -> size;
+	} else {
+		// the list is kept sorted, so its head is the leaderboard
+		for (Node *node = info -> head; node != NULL && node -> user.name != NULL && size < limit; node = node -> next) {
+			top[size++] = node -> user;
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t sequence = atomic_load_explicit(&segment -> sequence, memory_order_relaxed);
+	atomic_store_explicit(&segment -> sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < size; i++) {
+		segment -> top[i].count = top[i].count;
+		memcpy(segment -> top[i].name, top[i].name, strlen(top[i].name) + 1);
+	}
+	segment -> size = size;
+	segment -> rowsRead = summary -> rowsRead;
+	segment -> rowsCounted = summary -> rowsCounted;
+	segment -> offset = summary -> bytesRead;
+	segment -> updatedNanos = now.tv_sec * 1000000000LL + now.tv_nsec;
+	segment -> finished = finished;
+	atomic_store_explicit(&segment -> sequence, sequence + 2, memory_order_release);
+	publisher -> nextRow = summary -> rowsRead + batch;
+}
+
+/**
+ * @brief Unmaps the --publish segment (which stays in place)
+ *
+ * @param publisher Publisher to be freed
+ * @return void
+ */
+void closePublisher(Publisher *publisher)
+{
+	munmap(publisher -> segment, publisher -> bytes);
+	free(publisher -> top);
+	free(publisher);
+}
+
+/**
+ * @brief Prints a consistent snapshot of a --publish segment
+ *
+ * This is the reader side of the seqlock: copy the segment between two
+ * reads of the sequence number and retry until both are the same even
+ * number. The writer is never waited on and, once the segment is mapped,
+ * only the clock is read, and only while an update is under way. A sequence that stays odd and unchanged for
+ * PUBLISH_STALL_NANOS belongs to a publisher that died mid-update, so
+ * the reader stops instead of spinning on it forever.
+ *
+ * @param opts Options holding the segment name
+ * @param summary Set to the rows of the snapshot
+ * @return void
+ */
+void readPublished(Options *opts, Summary *summary)
+{
+	char path[NAME_MAX + 2];
+	char *name = opts -> readPublished;
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if (fd == -1) forceExit("\nError: No shared memory segment\n");
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Published)) {
+		close(fd);
+		forceExit("\nError: Not a published leaderboard\n");
+	}
+	size_t bytes = info.st_size;
+	Published *segment = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED) forceExit("\nError: Couldn't map shared memory segment\n");
+	Published *copy = malloc(bytes);
+	if (copy == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	uint64_t before, after, stalled = 0, since = 0;
+	do {
+		before = atomic_load_explicit(&segment -> sequence, memory_order_acquire);
+		if ((before & 1) != 0 && before != stalled) {
+			stalled = before;
+			since = monotonicNanos();
+		} else if ((before & 1) != 0 && monotonicNanos() - since > PUBLISH_STALL_NANOS) {
+			free(copy);
+			munmap(segment, bytes);
+			forceExit("\nError: publisher stopped mid-update\n");
+		}
+		memcpy(copy, segment, bytes);
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&segment -> sequence, memory_order_relaxed);
+	} while (before != after || (before & 1) != 0);
+	if (memcmp(copy -> magic, PUBLISH_MAGIC, 4) != 0 || copy -> version != PUBLISH_VERSION
+			|| copy -> capacity > (bytes - sizeof(Published)) / sizeof(PublishedName) || copy -> size > copy -> capacity) {
+		forceExit("\nError: Not a published leaderboard\n");
+	}
+	for (uint32_t i = 0; i < copy -> size; i++) {
+		copy -> top[i].name[MAX_CHAR - 1] = '\0';
+		printf("%s: %" PRId64 "\n", copy -> top[i].name, copy -> top[i].count);
+	}
+	summary -> rowsRead = copy -> rowsRead;
+	summary -> rowsCounted = copy -> rowsCounted;
+	if (opts -> summary) {
+		time_t seconds = copy -> updatedNanos / 1000000000LL;
+		char when[32];
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+		fprintf(stderr, "\nPublished at: %s (input byte %" PRId64 ")%s\n", when, copy -> offset,
+				copy -> finished ? "" : ", still running");
+	}
+	free(copy);
+	munmap(segment, bytes);
+}
+
+/**
+ * @brief Opens the --metrics endpoint and starts the thread answering it
+ * 
+ * @param path Location of the UNIX socket
+ * @param blockCount Number of ingest threads, each getting a counter block
+ * @return The endpoint (to be closed with closeMetrics)
+ */
+Metrics *createMetrics(char *path, int blockCount)
+{
+	Metrics *metrics = malloc(sizeof(Metrics));
+	void *blocks = NULL;
+	if (metrics == NULL || posix_memalign(&blocks, METRICS_LINE, blockCount * sizeof(MetricsCounters)) != 0) {
+		forceExit("\nError: Couldn't allocate memory -- Metrics\n");
+	}
+	memset(blocks, 0, blockCount * sizeof(MetricsCounters));
+	metrics -> blocks = blocks;
+	metrics -> blockCount = blockCount;
+	for (int i = 0; i < blockCount; i++) metrics -> blocks[i].phase = PHASE_HEADER;
+	metrics -> path = path;
+	metrics -> startNanos = monotonicNanos();
+	atomic_init(&metrics -> running, 1);
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) forceExit("\nError: --metrics socket path too long\n");
+	strcpy(address.sun_path, path);
+	// only a socket left behind by an earlier run is replaced
+	struct stat existing;
+	if (stat(path, &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(path);
+	metrics -> listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (metrics -> listener == -1 || bind(metrics -> listener, (struct sockaddr *) &address, sizeof(address)) != 0
+			|| listen(metrics -> listener, SERVE_CLIENTS) != 0) {
+		forceExit("\nError: Couldn't listen on --metrics socket\n");
+	}
+	if (pthread_create(&metrics -> thread, NULL, serveMetrics, metrics) != 0) {
+		forceExit("\nError: Couldn't start metrics thread\n");
+	}
+	return metrics;
+}
+
+/**
+ * @brief Stops the --metrics endpoint and removes its socket
+ * 
+ * @param metrics Endpoint to be closed (no ingest thread may still be counting)
+ * @return void
+ */
+void closeMetrics(Metrics *metrics)
+{
+	atomic_store(&metrics -> running, 0);
+	// wakes the thread out of accept
+	shutdown(metrics -> listener, SHUT_RDWR);
+	pthread_join(metrics -> thread, NULL);
+	close(metrics -> listener);
+	unlink(metrics -> path);
+	free(metrics -> blocks);
+	free(metrics);
+}
+
+/**
+ * @brief Body of the --metrics thread: answers one HTTP request per connection
+ * 
+ * The request is read up to its blank line (or METRICS_REQUEST bytes, or
+ * a second of silence), and GET /metrics is answered with the Prometheus
+ * text format, anything else with a 404. The connection is then closed,
+ * as HTTP/1.0 allows, so a stuck client holds up one scrape at most.
+ * 
+ * @param arg The Metrics
+ * @return NULL
+ */
+void *serveMetrics(void *arg)
+{
+	Metrics *metrics = arg;
+	char request[METRICS_REQUEST + 1];
+	while (atomic_load(&metrics -> running)) {
+		int client = accept(metrics -> listener, NULL, NULL);
+		if (client < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+		if (client < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)) {
+			// out of descriptors or memory -- give the ingest threads a moment instead of spinning
+			poll(NULL, 0, 100);
+			continue;
+		}
+		// anything else (EINVAL once closeMetrics shuts the socket down) ends the endpoint
+		if (client < 0) break;
+		int length = 0;
+		struct pollfd fd = { .fd = client, .events = POLLIN };
+		while (length < METRICS_REQUEST && poll(&fd, 1, 1000) > 0) {
+			ssize_t got = read(client, request + length, METRICS_REQUEST - length);
+			if (got <= 0) break;
+			length += got;
+			request[length] = '\0';
+			if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+		}
+		request[length] = '\0';
+		char *text = NULL;
+		size_t size = 0;
+		FILE *reply = open_memstream(&text, &size);
+		if (reply == NULL) forceExit("\nError: Couldn't allocate memory -- Reply\n");
+		int found = strncmp(request, "GET ", 4) == 0;
+		if (found) {
+			size_t path = strcspn(request + 4, " \r\n");
+			found = path == strlen("/metrics") && strncmp(request + 4, "/metrics", path) == 0;
+		}
+		if (found) {
+			char *body = NULL;
+			size_t bodySize = 0;
+			FILE *out = open_memstream(&body, &bodySize);
+			if (out == NULL) forceExit("\nError: Couldn't allocate memory -- Reply\n");
+			writeMetrics(metrics, out);
+			fclose(out);
+			fprintf(reply, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n%s",
+					bodySize, body);
+			free(body);
+		} else {
+			fprintf(reply, "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n\r\nNot found\n");
+		}
+		fclose(reply);
+		sendReply(client, text, size);
+		free(text);
+		close(client);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Writes the --metrics counters in the Prometheus text format
+ * 
+ * Every ingest thread's block is added up here, on the endpoint thread,
+ * so scraping costs the ingest threads nothing. The latency buckets are
+ * kept one per power of two and made cumulative on the way out.
+ * 
+ * @param metrics Endpoint holding the counter blocks
+ * @param out Stream the exposition is written to
+ * @return void
+ */
+void writeMetrics(Metrics *metrics, FILE *out)
+{
+	// in the order of metricsReason
+	char *reasons[METRICS_REASONS] = { "wrong_fields", "line_too_long", "malformed_utf8", "invalid_id",
+			"invalid_timestamp", "invalid_name", "bad_quotes", "other" };
+	char *phases[PERF_PHASES] = { "header", "read", "tokenize", "insert", "ranking" };
+	unsigned long rows = 0, bytes = 0, names = 0, tableBytes = 0;
+	unsigned long rejected[METRICS_REASONS] = { 0 };
+	unsigned long latency[PERF_PHASES][METRICS_BUCKETS + 1] = { { 0 } };
+	unsigned long latencyNanos[PERF_PHASES] = { 0 };
+	for (int i = 0; i < metrics -> blockCount; i++) {
+		MetricsCounters *block = &metrics -> blocks[i];
+		rows += atomic_load_explicit(&block -> rows, memory_order_relaxed);
+		bytes += atomic_load_explicit(&block -> bytes, memory_order_relaxed);
+		names += atomic_load_explicit(&block -> names, memory_order_relaxed);
+		tableBytes += atomic_load_explicit(&block -> tableBytes, memory_order_relaxed);
+		for (int r = 0; r < METRICS_REASONS; r++) {
+			rejected[r] += atomic_load_explicit(&block -> rejected[r], memory_order_relaxed);
+		}
+		for (int p = PHASE_READ; p <= PHASE_INSERT; p++) {
+			for (int b = 0; b <= METRICS_BUCKETS; b++) {
+				latency[p][b] += atomic_load_explicit(&block -> latency[p][b], memory_order_relaxed);
+			}
+			latencyNanos[p] += atomic_load_explicit(&block -> latencyNanos[p], memory_order_relaxed);
+		}
+	}
+	double seconds = (monotonicNanos() - metrics -> startNanos) / 1e9;
+	fprintf(out, "# HELP maxtweeter_rows_read_total Rows read from the input.\n"
+			"# TYPE maxtweeter_rows_read_total counter\nmaxtweeter_rows_read_total %lu\n", rows);
+	fprintf(out, "# HELP maxtweeter_bytes_read_total Input bytes read.\n"
+			"# TYPE maxtweeter_bytes_read_total counter\nmaxtweeter_bytes_read_total %lu\n", bytes);
+	fprintf(out, "# HELP maxtweeter_rows_per_second Rows read per second since the run started.\n"
+			"# TYPE maxtweeter_rows_per_second gauge\nmaxtweeter_rows_per_second %.1f\n", seconds > 0 ? rows / seconds : 0);
+	fprintf(out, "# HELP maxtweeter_uptime_seconds Seconds since the run started.\n"
+			"# TYPE maxtweeter_uptime_seconds gauge\nmaxtweeter_uptime_seconds %.3f\n", seconds);
+	fprintf(out, "# HELP maxtweeter_names Distinct names held in the count table.\n"
+			"# TYPE maxtweeter_names gauge\nmaxtweeter_names %lu\n", names);
+	fprintf(out, "# HELP maxtweeter_table_bytes Estimated heap used by the count table.\n"
+			"# TYPE maxtweeter_table_bytes gauge\nmaxtweeter_table_bytes %lu\n", tableBytes);
+	fprintf(out, "# HELP maxtweeter_rows_rejected_total Invalid rows, by reason.\n"
+			"# TYPE maxtweeter_rows_rejected_total counter\n");
+	for (int r = 0; r < METRICS_REASONS; r++) {
+		fprintf(out, "maxtweeter_rows_rejected_total{reason=\"%s\"} %lu\n", reasons[r], rejected[r]);
+	}
+	fprintf(out, "# HELP maxtweeter_phase_seconds Time a row spends in each phase.\n"
+			"# TYPE maxtweeter_phase_seconds histogram\n");
+	for (int p = PHASE_READ; p <= PHASE_INSERT; p++) {
+		unsigned long count = 0;
+		for (int b = 0; b < METRICS_BUCKETS; b++) {
+			count += latency[p][b];
+			fprintf(out, "maxtweeter_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %lu\n", phases[p],
+					(double) (1UL << (METRICS_FIRST_BUCKET + b)) / 1e9, count);
+		}
+		count += latency[p][METRICS_BUCKETS];
+		fprintf(out, "maxtweeter_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lu\n", phases[p], count);
+		fprintf(out, "maxtweeter_phase_seconds_sum{phase=\"%s\"} %.9f\n", phases[p], latencyNanos[p] / 1e9);
+		fprintf(out, "maxtweeter_phase_seconds_count{phase=\"%s\"} %lu\n", phases[p], count);
+	}
+}
+
+/**
+ * @brief Adds to a --metrics counter from the one thread that owns it
+ * 
+ * A relaxed load and store instead of an atomic add: with a single
+ * writer nothing is lost, and no locked instruction is paid per row.
+ * 
+ * @param counter Counter in the calling thread's block
+ * @param amount Amount to be added
+ * @return void
+ */
+void metricsAdd(atomic_ulong *counter, unsigned long amount)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/**
+ * @brief Ends the phase being timed and starts the next one
+ * 
+ * The time since the last call goes into the finished phase's latency
+ * histogram. PHASE_HEADER parks the clock: nothing is recorded for it.
+ * 
+ * @param metrics Counters of the calling thread, NULL if unused
+ * @param phase Phase starting now
+ * @return void
+ */
+void metricsPhase(MetricsCounters *metrics, int phase)
+{
+	if (metrics == NULL) return;
+	uint64_t now = monotonicNanos();
+	if (metrics -> phase != PHASE_HEADER) {
+		uint64_t nanos = now - metrics -> phaseStart;
+		// bucket b holds times up to 1 << (METRICS_FIRST_BUCKET + b)
+		uint64_t below = nanos > 0 ? nanos - 1 : 0;
+		int bucket = 0;
+		while (bucket < METRICS_BUCKETS && below >> (METRICS_FIRST_BUCKET + bucket) != 0) bucket++;
+		metricsAdd(&metrics -> latency[metrics -> phase][bucket], 1);
+		metricsAdd(&metrics -> latencyNanos[metrics -> phase], nanos);
+	}
+	metrics -> phase = phase;
+	metrics -> phaseStart = now;
+}
+
+/**
+ * @brief Updates a thread's --metrics table gauges after an insert
+ * 
+ * Inserting only grows the table's byte estimate when the name is new,
+ * and only shrinks it when the table spills to disk and starts over.
+ * 
+ * @param metrics Counters of the calling thread
+ * @param info Data struct the name was inserted into
+ * @param before info -> bytes before the insert
+ * @return void
+ */
+void metricsTable(MetricsCounters *metrics, Link *info, unsigned long before)
+{
+	if (info -> bytes > before) {
+		metricsAdd(&metrics -> names, 1);
+	} else if (info -> bytes < before) {
+		atomic_store_explicit(&metrics -> names, 0, memory_order_relaxed);
+	} else {
+		return;
+	}
+	atomic_store_explicit(&metrics -> tableBytes, info -> bytes, memory_order_relaxed);
+}
+
+/**
+ * @brief Maps a rowError message to its --metrics reason
+ * 
+ * @param exitMsg Message rowError was called with
+ * @return Index into the rejected counters
+ */
+int metricsReason(char *exitMsg)
+{
+	char *messages[METRICS_REASONS - 1] = { "wrong number of fields", "too many characters", "malformed UTF-8",
+			"invalid id", "invalid timestamp", "invalid name", "quotes in" };
+	for (int r = 0; r < METRICS_REASONS - 1; r++) {
+		if (strstr(exitMsg, messages[r]) != NULL) return r;
+	}
+	return METRICS_REASONS - 1;
+}
+
+/**
+ * @brief Reads the monotonic clock
+ * 
+ * @return CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t monotonicNanos(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
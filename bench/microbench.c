@@ -0,0 +1,611 @@
+/**
+ * @file microbench.c
+ * @brief Microbenchmarks of the parsing and ranking primitives of maxTweeter.c
+ *
+ * maxTweeter.c is compiled into this file (its main renamed), so every
+ * benchmark calls the real functions with the flags of the build being
+ * measured. malloc, calloc, realloc and strdup are redirected to counting
+ * wrappers before it is included, which is how allocations per operation
+ * are measured without a custom allocator.
+ *
+ * Usage: ./bench/microbench.exe [options]
+ *   --csv file        Rows and names are taken from `file` (default: tests/cl-tweets-short-clean.csv)
+ *   --samples count   Timed samples per benchmark (default: 10)
+ *   --filter text     Only run benchmarks whose name contains `text`
+ *   --json out        Write one JSON object per benchmark to `out`
+ *   --compare base    Print the change in median ns/op against a --json file of another build
+ *
+ * Every sample runs a number of iterations calibrated to take about
+ * BENCH_SAMPLE_NS; the median, minimum and relative standard deviation of
+ * the samples' ns/op are reported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long benchAllocs = 0;
+static unsigned long benchAllocBytes = 0;
+
+static void *benchMalloc(size_t size)
+{
+	benchAllocs++;
+	benchAllocBytes += size;
+	return malloc(size);
+}
+
+static void *benchCalloc(size_t count, size_t size)
+{
+	benchAllocs++;
+	benchAllocBytes += count * size;
+	return calloc(count, size);
+}
+
+static void *benchRealloc(void *pointer, size_t size)
+{
+	benchAllocs++;
+	benchAllocBytes += size;
+	return realloc(pointer, size);
+}
+
+static char *benchStrdup(const char *text)
+{
+	size_t length = strlen(text) + 1;
+	char *copy = benchMalloc(length);
+	if (copy != NULL) memcpy(copy, text, length);
+	return copy;
+}
+
+#undef strdup
+#define malloc(size) benchMalloc(size)
+#define calloc(count, size) benchCalloc(count, size)
+#define realloc(pointer, size) benchRealloc(pointer, size)
+#define strdup(text) benchStrdup(text)
+#define main maxTweeterMain
+#include "../maxTweeter.c"
+#undef main
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+
+/* each sample runs for about this long */
+#define BENCH_SAMPLE_NS 20000000L
+
+/* most samples --samples accepts */
+#define BENCH_MAX_SAMPLES 1000
+
+/* distinct names in the synthetic name stream */
+#define BENCH_NAMES 2000
+
+/**
+ * BenchData defines the inputs shared by every benchmark.
+ *
+ * rows are the data rows of the CSV, names the NAME field of each row in
+ * file order, and synthetic a Zipf-distributed stream of BENCH_NAMES
+ * names so the list benchmarks also see a heavy-tailed workload.
+ */
+typedef struct benchdata
+{
+	char **rows;
+	char **names;
+	long rowCount;
+	char **synthetic;
+	long syntheticCount;
+	int namePos;
+	int quoted;
+	int comma;
+	char scratch[MAX_LINE + 1];
+	Link *info;
+	Node *nodes[4];
+	long inputBytes;
+} BenchData;
+
+/**
+ * Bench defines one benchmark.
+ *
+ * setup and teardown run outside the timed region around every sample;
+ * run performs iterations operations and adds the bytes it read to
+ * data -> inputBytes.
+ */
+typedef struct bench
+{
+	char *name;
+	void (*setup)(BenchData *data);
+	void (*run)(BenchData *data, long iterations);
+	void (*teardown)(BenchData *data);
+} Bench;
+
+volatile long benchSink;
+
+void benchCommaCounter(BenchData *data, long iterations);
+void benchCopyRow(BenchData *data, long iterations);
+void benchDictionaryAdd(BenchData *data, long iterations);
+void benchExtractName(BenchData *data, long iterations);
+void benchFindUser(BenchData *data, long iterations);
+void benchInsertAtLast(BenchData *data, long iterations);
+void benchInsertToList(BenchData *data, long iterations);
+void benchRemoveChar(BenchData *data, long iterations);
+void benchStripQuotes(BenchData *data, long iterations);
+void benchSwap(BenchData *data, long iterations);
+void benchTrimNewLine(BenchData *data, long iterations);
+void benchValidUtf8(BenchData *data, long iterations);
+int compareDoubles(const void *left, const void *right);
+void freeList(BenchData *data);
+void loadRows(BenchData *data, char *path);
+void makeSynthetic(BenchData *data);
+double medianOf(double *values, int count);
+void newDictionary(BenchData *data);
+void newList(BenchData *data);
+void newNamedList(BenchData *data);
+void newSwapList(BenchData *data);
+double previousResult(char *path, char *name);
+long timeRun(Bench *bench, BenchData *data, long iterations);
+
+static Bench benches[] = {
+	{ "copyRow", NULL, benchCopyRow, NULL },
+	{ "commaCounter", NULL, benchCommaCounter, NULL },
+	{ "extractName", NULL, benchExtractName, NULL },
+	{ "stripQuotes", NULL, benchStripQuotes, NULL },
+	{ "removeChar", NULL, benchRemoveChar, NULL },
+	{ "trimNewLine", NULL, benchTrimNewLine, NULL },
+	{ "validUtf8", NULL, benchValidUtf8, NULL },
+	{ "findUser", newNamedList, benchFindUser, freeList },
+	{ "swap", newSwapList, benchSwap, freeList },
+	{ "insertAtLast", newList, benchInsertAtLast, freeList },
+	{ "insertToList/csv", newList, benchInsertToList, freeList },
+	{ "dictionaryAdd/csv", newDictionary, benchDictionaryAdd, freeList },
+};
+
+int main(int argc, char *argv[])
+{
+	char *csv = "tests/cl-tweets-short-clean.csv", *filter = NULL, *jsonPath = NULL, *compare = NULL;
+	int samples = 10;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csv = argv[++i];
+		} else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+			samples = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --samples\n");
+			if (samples > BENCH_MAX_SAMPLES) samples = BENCH_MAX_SAMPLES;
+		} else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			filter = argv[++i];
+		} else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			jsonPath = argv[++i];
+		} else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+			compare = argv[++i];
+		} else {
+			forceExit("\nInvalid Program Call -- Usage: ./bench/microbench.exe [--csv file] [--samples count] "
+					"[--filter text] [--json out] [--compare base]\n");
+		}
+	}
+	BenchData data;
+	memset(&data, 0, sizeof(data));
+	loadRows(&data, csv);
+	makeSynthetic(&data);
+	FILE *json = NULL;
+	if (jsonPath != NULL) {
+		json = fopen(jsonPath, "w");
+		if (json == NULL) forceExit("\nError: Couldn't open JSON file\n");
+	}
+	printf("%-20s %8s %12s %7s %12s %10s %11s %11s%s\n", "benchmark", "samples", "ns/op", "+-%", "min ns/op",
+			"allocs/op", "alloc B/op", "input B/op", compare != NULL ? "      vs base" : "");
+	double times[BENCH_MAX_SAMPLES];
+	for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		Bench *bench = &benches[b];
+		if (filter != NULL && strstr(bench -> name, filter) == NULL) continue;
+		// double the iterations until one sample takes long enough to time
+		long iterations = 1;
+		while (timeRun(bench, &data, iterations) < BENCH_SAMPLE_NS / 10 && iterations < (1L << 30)) iterations *= 2;
+		iterations = iterations * 10;
+		unsigned long allocs = 0, allocBytes = 0;
+		long inputBytes = 0;
+		for (int s = 0; s < samples; s++) {
+			data.inputBytes = 0;
+			if (bench -> setup != NULL) bench -> setup(&data);
+			unsigned long allocsBefore = benchAllocs, bytesBefore = benchAllocBytes;
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			bench -> run(&data, iterations);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			allocs += benchAllocs - allocsBefore;
+			allocBytes += benchAllocBytes - bytesBefore;
+			inputBytes += data.inputBytes;
+			if (bench -> teardown != NULL) bench -> teardown(&data);
+			times[s] = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+		}
+		double operations = (double) iterations * samples, mean = 0, variance = 0, min = times[0];
+		for (int s = 0; s < samples; s++) {
+			mean += times[s] / samples;
+			if (times[s] < min) min = times[s];
+		}
+		for (int s = 0; s < samples; s++) variance += (times[s] - mean) * (times[s] - mean) / samples;
+		double median = medianOf(times, samples);
+		double spread = mean > 0 ? 100 * sqrt(variance) / mean : 0;
+		printf("%-20s %8d %12.2f %7.1f %12.2f %10.3f %11.1f %11.1f", bench -> name, samples, median, spread, min,
+				allocs / operations, allocBytes / operations, inputBytes / operations);
+		if (compare != NULL) {
+			double base = previousResult(compare, bench -> name);
+			if (base > 0) {
+				printf(" %+12.1f%%", 100 * (median - base) / base);
+			} else {
+				printf(" %13s", "n/a");
+			}
+		}
+		printf("\n");
+		if (json != NULL) {
+			fprintf(json, "{\"name\": \"%s\", \"samples\": %d, \"iterations\": %ld, \"ns_per_op\": %.3f, "
+					"\"ns_per_op_min\": %.3f, \"ns_per_op_rsd\": %.2f, \"allocs_per_op\": %.4f, "
+					"\"alloc_bytes_per_op\": %.2f, \"input_bytes_per_op\": %.2f}\n", bench -> name, samples,
+					iterations, median, min, spread, allocs / operations, allocBytes / operations,
+					inputBytes / operations);
+		}
+	}
+	if (json != NULL && fclose(json) != 0) forceExit("\nError: Couldn't write JSON file\n");
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Times one untracked run of a benchmark, for calibration
+ *
+ * @param bench Benchmark to be run
+ * @param data Shared inputs
+ * @param iterations Operations to run
+ * @return Nanoseconds taken
+ */
+long timeRun(Bench *bench, BenchData *data, long iterations)
+{
+	struct timespec start, end;
+	if (bench -> setup != NULL) bench -> setup(data);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bench -> run(data, iterations);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (bench -> teardown != NULL) bench -> teardown(data);
+	return (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+}
+
+/**
+ * @brief Reads the data rows and names of a CSV
+ *
+ * Rows which maxTweeter.exe would reject are left out, so every
+ * benchmark sees only valid input.
+ *
+ * @param data Inputs to be filled in
+ * @param path Location of the CSV
+ * @return void
+ */
+void loadRows(BenchData *data, char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL) forceExit("\nError: No file\n");
+	Options opts;
+	initOptions(&opts);
+	int oneCol = -1;
+	data -> quoted = -1;
+	data -> namePos = getNameIndex(file, &data -> quoted, &data -> comma, &oneCol, &opts);
+	long allocated = 1024;
+	data -> rows = malloc(allocated * sizeof(char *));
+	data -> names = malloc(allocated * sizeof(char *));
+	char line[MAX_LINE + 1];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strlen(line) >= MAX_CHAR || commaCounter(line) != data -> comma) continue;
+		char *error = NULL;
+		strcpy(data -> scratch, line);
+		char *name = extractName(data -> scratch, data -> namePos, data -> quoted, &error);
+		if (error != NULL || name == NULL || strcmp(name, "invalid") == 0) continue;
+		if (data -> rowCount == allocated) {
+			allocated *= 2;
+			data -> rows = realloc(data -> rows, allocated * sizeof(char *));
+			data -> names = realloc(data -> names, allocated * sizeof(char *));
+		}
+		data -> rows[data -> rowCount] = strdup(line);
+		data -> names[data -> rowCount++] = strdup(*name == '\0' ? "empty" : name);
+	}
+	fclose(file);
+	if (data -> rowCount == 0) forceExit("\nError: No valid rows in the benchmark CSV\n");
+}
+
+/**
+ * @brief Builds the synthetic Zipf-distributed name stream
+ *
+ * @param data Inputs to be filled in
+ * @return void
+ */
+void makeSynthetic(BenchData *data)
+{
+	data -> syntheticCount = 1 << 16;
+	data -> synthetic = malloc(data -> syntheticCount * sizeof(char *));
+	char **pool = malloc(BENCH_NAMES * sizeof(char *));
+	double *cumulative = malloc(BENCH_NAMES * sizeof(double));
+	double total = 0;
+	for (int i = 0; i < BENCH_NAMES; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "user_%04d", i);
+		pool[i] = strdup(name);
+		total += 1.0 / (i + 1);
+		cumulative[i] = total;
+	}
+	// a fixed seed so every build sees the same stream
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (long i = 0; i < data -> syntheticCount; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		double pick = (state >> 11) * (1.0 / 9007199254740992.0) * total;
+		int low = 0, high = BENCH_NAMES - 1;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (cumulative[middle] < pick) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		data -> synthetic[i] = pool[low];
+	}
+	free(cumulative);
+}
+
+/**
+ * @brief Starts an empty list, as main does
+ *
+ * @param data Inputs holding the list
+ * @return void
+ */
+void newList(BenchData *data)
+{
+	data -> info = malloc(sizeof(Link));
+	Node *first = createNode(1, data -> info);
+	data -> info -> head = first;
+	data -> info -> last = first;
+	data -> info -> bytes = 0;
+	data -> info -> spill = NULL;
+	data -> info -> dict = NULL;
+	data -> info -> shared = NULL;
+}
+
+/**
+ * @brief Starts a list already holding every synthetic name
+ *
+ * @param data Inputs holding the list
+ * @return void
+ */
+void newNamedList(BenchData *data)
+{
+	newList(data);
+	for (long i = 0; i < data -> syntheticCount; i++) insertToList(data -> synthetic[i], data -> info);
+}
+
+/**
+ * @brief Starts a list of four nodes for the swap benchmark
+ *
+ * @param data Inputs holding the list and its nodes
+ * @return void
+ */
+void newSwapList(BenchData *data)
+{
+	newList(data);
+	char *names[] = { "a", "b", "c", "d" };
+	for (int i = 0; i < 4; i++) insertToList(names[i], data -> info);
+	Node *current = data -> info -> head;
+	for (int i = 0; i < 4; i++, current = current -> next) data -> nodes[i] = current;
+}
+
+/**
+ * @brief Starts an empty list counting into a name dictionary
+ *
+ * @param data Inputs holding the list
+ * @return void
+ */
+void newDictionary(BenchData *data)
+{
+	newList(data);
+	data -> info -> dict = createDictionary();
+}
+
+/**
+ * @brief Frees the list (and dictionary) of a benchmark
+ *
+ * @param data Inputs holding the list
+ * @return void
+ */
+void freeList(BenchData *data)
+{
+	if (data -> info -> dict != NULL) freeDictionary(data -> info -> dict);
+	freeLinkedMemory(data -> info -> head, data -> info);
+	data -> info = NULL;
+}
+
+/**
+ * @brief Baseline: copying a row into the scratch buffer, which the
+ * benchmarks of functions that modify their input also pay for
+ */
+void benchCopyRow(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *row = data -> rows[i % data -> rowCount];
+		size_t length = strlen(row);
+		memcpy(data -> scratch, row, length + 1);
+		data -> inputBytes += length;
+	}
+	benchSink = data -> scratch[0];
+}
+
+void benchCommaCounter(BenchData *data, long iterations)
+{
+	long sum = 0;
+	for (long i = 0; i < iterations; i++) {
+		char *row = data -> rows[i % data -> rowCount];
+		sum += commaCounter(row);
+		data -> inputBytes += strlen(row);
+	}
+	benchSink = sum;
+}
+
+void benchExtractName(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *row = data -> rows[i % data -> rowCount];
+		size_t length = strlen(row);
+		memcpy(data -> scratch, row, length + 1);
+		char *error = NULL;
+		benchSink = (long) extractName(data -> scratch, data -> namePos, data -> quoted, &error);
+		data -> inputBytes += length;
+	}
+}
+
+void benchStripQuotes(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> synthetic[i % data -> syntheticCount];
+		size_t length = strlen(name);
+		data -> scratch[0] = '"';
+		memcpy(data -> scratch + 1, name, length);
+		data -> scratch[length + 1] = '"';
+		data -> scratch[length + 2] = '\0';
+		benchSink = (long) stripQuotes(data -> scratch);
+		data -> inputBytes += length + 2;
+	}
+}
+
+void benchRemoveChar(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> names[i % data -> rowCount];
+		size_t length = strlen(name);
+		memcpy(data -> scratch, name, length + 1);
+		removeChar(data -> scratch, 0);
+		data -> inputBytes += length;
+	}
+	benchSink = data -> scratch[0];
+}
+
+void benchTrimNewLine(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> names[i % data -> rowCount];
+		size_t length = strlen(name);
+		memcpy(data -> scratch, name, length);
+		data -> scratch[length] = '\n';
+		data -> scratch[length + 1] = '\0';
+		trimNewLine(data -> scratch);
+		data -> inputBytes += length + 1;
+	}
+	benchSink = data -> scratch[0];
+}
+
+/**
+ * @brief Replacement candidate: validates the row's UTF-8, the per-row
+ * cost --utf8 adds on top of commaCounter
+ */
+void benchValidUtf8(BenchData *data, long iterations)
+{
+	long sum = 0;
+	for (long i = 0; i < iterations; i++) {
+		char *row = data -> rows[i % data -> rowCount];
+		size_t length = strlen(row);
+		sum += validUtf8(row, length);
+		data -> inputBytes += length;
+	}
+	benchSink = sum;
+}
+
+void benchFindUser(BenchData *data, long iterations)
+{
+	long found = 0;
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> synthetic[i % data -> syntheticCount];
+		found += findUser(name, data -> info);
+		data -> inputBytes += strlen(name);
+	}
+	benchSink = found;
+}
+
+void benchSwap(BenchData *data, long iterations)
+{
+	// swapping the middle pair back and forth takes the regular swap path
+	Node *left = data -> nodes[1], *right = data -> nodes[2];
+	for (long i = 0; i < iterations; i++) {
+		swap(left, right, data -> info);
+		Node *tmp = left;
+		left = right;
+		right = tmp;
+	}
+	benchSink = (long) data -> info -> head;
+}
+
+void benchInsertAtLast(BenchData *data, long iterations)
+{
+	insertToList("head", data -> info);
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> synthetic[i % data -> syntheticCount];
+		insertAtLast(name, data -> info);
+		data -> inputBytes += strlen(name);
+	}
+}
+
+void benchInsertToList(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> names[i % data -> rowCount];
+		insertToList(name, data -> info);
+		data -> inputBytes += strlen(name);
+	}
+}
+
+/**
+ * @brief Replacement candidate: the --compact dictionary over the same
+ * name stream as insertToList/csv
+ */
+void benchDictionaryAdd(BenchData *data, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		char *name = data -> names[i % data -> rowCount];
+		insertToList(name, data -> info);
+		data -> inputBytes += strlen(name);
+	}
+}
+
+/**
+ * @brief Median of a set of samples (which are reordered)
+ *
+ * @param values Samples
+ * @param count Number of samples
+ * @return The median
+ */
+double medianOf(double *values, int count)
+{
+	qsort(values, count, sizeof(double), compareDoubles);
+	return count % 2 == 1 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/**
+ * @brief qsort comparator ordering doubles ascending
+ */
+int compareDoubles(const void *left, const void *right)
+{
+	double a = *(const double *) left, b = *(const double *) right;
+	return (a > b) - (a < b);
+}
+
+/**
+ * @brief Looks up a benchmark's median ns/op in a --json file
+ *
+ * @param path Location of the --json output of another build
+ * @param name Benchmark name
+ * @return The median ns/op, or 0 if the file doesn't have the benchmark
+ */
+double previousResult(char *path, char *name)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL) forceExit("\nError: Couldn't open comparison file\n");
+	char line[1024], found[256];
+	double value = 0, median = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *field = strstr(line, "\"ns_per_op\": ");
+		if (sscanf(line, "{\"name\": \"%255[^\"]\"", found) == 1 && strcmp(found, name) == 0 && field != NULL
+				&& sscanf(field, "\"ns_per_op\": %lf", &median) == 1) {
+			value = median;
+		}
+	}
+	fclose(file);
+	return value;
+}
@@ -0,0 +1,362 @@
+/**
+ * @file scaling.c
+ * @brief Scaling test of the ingest path of maxTweeter.c
+ *
+ * maxTweeter.c is compiled into this file (its main renamed), so the
+ * real getNameIndex and processData are run. Each axis generates CSVs in
+ * memory whose size along that axis doubles while everything else stays
+ * fixed, times the ingest of each, and fits the growth exponent k of
+ * time ~ size^k by least squares on the log-log points of the largest
+ * sizes. The test fails when an axis grows faster than its bound.
+ *
+ * Usage: ./bench/scaling.exe [options]
+ *   --engine name     Only test the `list` (default path) or `compact` count table
+ *   --axis name       Only test one of rows, names, length and columns
+ *   --bound spec      Override a bound, as `axis=k` or `engine:axis=k` (repeatable)
+ *   --min-ms ms       Time every point for at least this long (default: 50)
+ *   --verbose         Print the time of every point
+ *
+ * Sizes stay inside MAX_LINE rows and MAX_CHAR characters per line.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define main maxTweeterMain
+#include "../maxTweeter.c"
+#undef main
+
+/* points per axis, and how many of the largest ones the exponent is
+ * fitted on (the smaller ones are dominated by fixed costs) */
+#define SCALING_POINTS 5
+#define SCALING_FIT 3
+
+/* rows of the axes which don't scale rows */
+#define SCALING_ROWS 4000
+
+/* distinct names of the axes which don't scale names */
+#define SCALING_NAMES 64
+
+/**
+ * Axis defines one dimension the input is scaled along.
+ *
+ * Point p of the axis has size first << p along it. rows, names, text
+ * and columns give the shape of the CSV at that point.
+ */
+typedef struct axis
+{
+	char *name;
+	long first;
+	void (*shape)(long size, long *rows, long *names, long *text, long *columns);
+} Axis;
+
+/**
+ * Bound defines the largest growth exponent an axis may have.
+ */
+typedef struct bound
+{
+	char *engine;
+	char *axis;
+	double exponent;
+	char *reason;
+} Bound;
+
+void columnsShape(long size, long *rows, long *names, long *text, long *columns);
+double fitExponent(double *sizes, double *times, int count);
+char *generateCsv(long rows, long names, long text, long columns, size_t *length);
+void lengthShape(long size, long *rows, long *names, long *text, long *columns);
+void namesShape(long size, long *rows, long *names, long *text, long *columns);
+Bound *findBound(char *engine, char *axis);
+void rowsShape(long size, long *rows, long *names, long *text, long *columns);
+void setBound(char *spec);
+double timeIngest(char *csv, size_t length, int compact, long minNs);
+
+static Axis axes[] = {
+	{ "rows", 1000, rowsShape },
+	{ "names", 64, namesShape },
+	{ "length", 56, lengthShape },
+	{ "columns", 28, columnsShape },
+};
+
+static char *engines[] = { "list", "compact" };
+
+/* every ingest is expected to be linear in its input; the one known
+ * exception is findUser, which scans the list for every row */
+static Bound bounds[] = {
+	{ "list", "rows", 1.2, NULL },
+	{ "list", "names", 1.2, "findUser scans the list, so a row costs O(distinct names)" },
+	{ "list", "length", 1.2, NULL },
+	{ "list", "columns", 1.2, NULL },
+	{ "compact", "rows", 1.2, NULL },
+	{ "compact", "names", 0.5, NULL },
+	{ "compact", "length", 1.2, NULL },
+	{ "compact", "columns", 1.2, NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	char *onlyEngine = NULL, *onlyAxis = NULL;
+	long minNs = 50 * 1000000L;
+	int verbose = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+			onlyEngine = argv[++i];
+		} else if (strcmp(argv[i], "--axis") == 0 && i + 1 < argc) {
+			onlyAxis = argv[++i];
+		} else if (strcmp(argv[i], "--bound") == 0 && i + 1 < argc) {
+			setBound(argv[++i]);
+		} else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+			minNs = parseNumberArg(argv[++i], "\nInvalid Program Call -- Bad --min-ms\n") * 1000000L;
+		} else if (strcmp(argv[i], "--verbose") == 0) {
+			verbose = 1;
+		} else {
+			forceExit("\nInvalid Program Call -- Usage: ./bench/scaling.exe [--engine name] [--axis name] "
+					"[--bound spec] [--min-ms ms] [--verbose]\n");
+		}
+	}
+	int failures = 0, tested = 0;
+	printf("%-8s %-8s %14s %9s %7s  %s\n", "engine", "axis", "sizes", "exponent", "bound", "result");
+	for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		if (onlyEngine != NULL && strcmp(onlyEngine, engines[e]) != 0) continue;
+		for (size_t a = 0; a < sizeof(axes) / sizeof(axes[0]); a++) {
+			Axis *axis = &axes[a];
+			if (onlyAxis != NULL && strcmp(onlyAxis, axis -> name) != 0) continue;
+			double sizes[SCALING_POINTS], times[SCALING_POINTS];
+			for (int p = 0; p < SCALING_POINTS; p++) {
+				long rows, names, text, columns;
+				long size = axis -> first << p;
+				axis -> shape(size, &rows, &names, &text, &columns);
+				size_t length = 0;
+				char *csv = generateCsv(rows, names, text, columns, &length);
+				sizes[p] = size;
+				times[p] = timeIngest(csv, length, e == 1, minNs);
+				free(csv);
+				if (verbose) {
+					printf("  %s %s=%ld: %ld rows, %ld names, %ld text, %ld columns, %.3f ms\n", engines[e],
+							axis -> name, size, rows, names, text, columns, times[p] / 1e6);
+				}
+			}
+			double exponent = fitExponent(sizes + SCALING_POINTS - SCALING_FIT, times + SCALING_POINTS - SCALING_FIT,
+					SCALING_FIT);
+			Bound *bound = findBound(engines[e], axis -> name);
+			int passed = exponent <= bound -> exponent;
+			char range[32];
+			snprintf(range, sizeof(range), "%ld..%ld", axis -> first, axis -> first << (SCALING_POINTS - 1));
+			printf("%-8s %-8s %14s %9.2f %7.2f  %s", engines[e], axis -> name, range, exponent, bound -> exponent,
+					passed ? "ok" : "FAIL");
+			if (bound -> reason != NULL) printf(" (%s)", bound -> reason);
+			printf("\n");
+			failures += !passed;
+			tested++;
+		}
+	}
+	if (tested == 0) forceExit("\nInvalid Program Call -- No such engine or axis\n");
+	if (failures > 0) {
+		printf("\n%d of %d axes grew faster than their bound\n", failures, tested);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Scales the number of rows
+ */
+void rowsShape(long size, long *rows, long *names, long *text, long *columns)
+{
+	*rows = size;
+	*names = SCALING_NAMES;
+	*text = 16;
+	*columns = 3;
+}
+
+/**
+ * @brief Scales the number of distinct names at a fixed number of rows
+ */
+void namesShape(long size, long *rows, long *names, long *text, long *columns)
+{
+	*rows = 16000;
+	*names = size;
+	*text = 16;
+	*columns = 3;
+}
+
+/**
+ * @brief Scales the length of the text column, and so of every line
+ */
+void lengthShape(long size, long *rows, long *names, long *text, long *columns)
+{
+	*rows = SCALING_ROWS;
+	*names = SCALING_NAMES;
+	*text = size;
+	*columns = 3;
+}
+
+/**
+ * @brief Scales the number of columns (each one short)
+ */
+void columnsShape(long size, long *rows, long *names, long *text, long *columns)
+{
+	*rows = SCALING_ROWS;
+	*names = SCALING_NAMES;
+	*text = 1;
+	*columns = size;
+}
+
+/**
+ * @brief Generates a CSV of the given shape
+ *
+ * Column 0 is an id, column 1 the quoted name and every other column
+ * text characters long. Names are used round-robin, so each one has
+ * about rows / names rows.
+ *
+ * @param rows Number of data rows
+ * @param names Number of distinct names
+ * @param text Characters in every column after the name
+ * @param columns Number of columns, at least 3
+ * @param length Set to the length of the CSV
+ * @return The CSV, to be freed by the caller
+ */
+char *generateCsv(long rows, long names, long text, long columns, size_t *length)
+{
+	size_t line = 32 + columns * (text + 8);
+	size_t capacity = (rows + 1) * line;
+	char *csv = malloc(capacity);
+	if (csv == NULL) forceExit("\nError: Couldn't allocate memory\n");
+	size_t used = snprintf(csv, capacity, "id,\"name\"");
+	for (long c = 2; c < columns; c++) used += snprintf(csv + used, capacity - used, ",col%ld", c);
+	csv[used++] = '\n';
+	for (long r = 0; r < rows; r++) {
+		used += snprintf(csv + used, capacity - used, "%ld,\"user_%06ld\"", r, r % names);
+		for (long c = 2; c < columns; c++) {
+			csv[used++] = ',';
+			memset(csv + used, 'a' + c % 26, text);
+			used += text;
+		}
+		csv[used++] = '\n';
+	}
+	csv[used] = '\0';
+	*length = used;
+	return csv;
+}
+
+/**
+ * @brief Times the ingest of a CSV held in memory
+ *
+ * The CSV is read through fmemopen by getNameIndex and processData, the
+ * same calls main makes. Runs are repeated until they have taken minNs
+ * in total.
+ *
+ * @param csv CSV contents
+ * @param length Length of the CSV
+ * @param compact Count in a NameDictionary instead of the list
+ * @param minNs Nanoseconds to keep repeating for
+ * @return Nanoseconds per ingest
+ */
+double timeIngest(char *csv, size_t length, int compact, long minNs)
+{
+	long runs = 0, elapsed = 0;
+	while (elapsed < minNs || runs < 3) {
+		Options opts;
+		Summary summary = { 0 };
+		initOptions(&opts);
+		opts.compact = compact;
+		FILE *file = fmemopen(csv, length, "r");
+		if (file == NULL) forceExit("\nError: Couldn't open the generated CSV\n");
+		Link *info = calloc(1, sizeof(Link));
+		if (info == NULL) forceExit("\nError: Couldn't allocate memory\n");
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		Node *first = createNode(1, info);
+		info -> head = first;
+		info -> last = first;
+		if (compact) info -> dict = createDictionary();
+		int quoted = -1;
+		int comma = 0;
+		int oneCol = -1;
+		int namePos = getNameIndex(file, &quoted, &comma, &oneCol, &opts);
+		processData(file, namePos, info, quoted, comma, oneCol, &opts, &summary);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		fclose(file);
+		if (info -> dict != NULL) freeDictionary(info -> dict);
+		freeLinkedMemory(info -> head, info);
+		elapsed += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+		runs++;
+	}
+	return (double) elapsed / runs;
+}
+
+/**
+ * @brief Fits the exponent k of time ~ size^k
+ *
+ * @param sizes Size of every point
+ * @param times Time of every point
+ * @param count Number of points
+ * @return Least-squares slope of log(time) against log(size)
+ */
+double fitExponent(double *sizes, double *times, int count)
+{
+	double meanX = 0, meanY = 0, covariance = 0, variance = 0;
+	for (int i = 0; i < count; i++) {
+		meanX += log(sizes[i]) / count;
+		meanY += log(times[i]) / count;
+	}
+	for (int i = 0; i < count; i++) {
+		covariance += (log(sizes[i]) - meanX) * (log(times[i]) - meanY);
+		variance += (log(sizes[i]) - meanX) * (log(sizes[i]) - meanX);
+	}
+	return covariance / variance;
+}
+
+/**
+ * @brief Looks up the bound of an axis for an engine
+ *
+ * @param engine Engine name
+ * @param axis Axis name
+ * @return The bound
+ */
+Bound *findBound(char *engine, char *axis)
+{
+	for (size_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++) {
+		if (strcmp(bounds[b].engine, engine) == 0 && strcmp(bounds[b].axis, axis) == 0) return &bounds[b];
+	}
+	forceExit("\nError: No bound for an axis\n");
+	return NULL;
+}
+
+/**
+ * @brief Overrides bounds from an `axis=k` or `engine:axis=k` argument
+ *
+ * @param spec The --bound value
+ * @return void
+ */
+void setBound(char *spec)
+{
+	char *equals = strchr(spec, '=');
+	char *colon = strchr(spec, ':');
+	char *end = NULL;
+	if (equals == NULL || (colon != NULL && colon > equals)) {
+		forceExit("\nInvalid Program Call -- --bound must be axis=k or engine:axis=k\n");
+	}
+	double exponent = strtod(equals + 1, &end);
+	if (end == equals + 1 || *end != '\0' || !(exponent > 0)) {
+		forceExit("\nInvalid Program Call -- --bound must be axis=k or engine:axis=k\n");
+	}
+	char *axis = colon != NULL ? colon + 1 : spec;
+	int matched = 0;
+	for (size_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++) {
+		if (colon != NULL && ((size_t) (colon - spec) != strlen(bounds[b].engine)
+				|| strncmp(spec, bounds[b].engine, colon - spec) != 0)) {
+			continue;
+		}
+		if ((size_t) (equals - axis) != strlen(bounds[b].axis) || strncmp(axis, bounds[b].axis, equals - axis) != 0) {
+			continue;
+		}
+		bounds[b].exponent = exponent;
+		bounds[b].reason = NULL;
+		matched++;
+	}
+	if (matched == 0) forceExit("\nInvalid Program Call -- --bound names no engine and axis\n");
+}